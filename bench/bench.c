@@ -0,0 +1,710 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "baseline.h"
+#include "deque.h"
+#include "libtest.h"
+#include "multi.h"
+#include "perf.h"
+#include "queue.h"
+#include "sheaf.h"
+#include "sheaf_inline.h"
+
+/* Relax strategy sheaf was built with, numbered as in scripts/bench.sh */
+#if defined(__SHEAF_RELAX_OS)
+#define SHEAF_YIELD 1
+#elif defined(__SHEAF_RELAX_BACKOFF)
+#define SHEAF_YIELD 2
+#else
+#define SHEAF_YIELD 0
+#endif
+
+/* Heads sheaf was built with */
+#ifdef SHEAF_INDEX_HEAD
+#define SHEAF_IMPL "sheaf-index"
+#else
+#define SHEAF_IMPL "sheaf"
+#endif
+
+/*
+ * Latency histogram. Values below HIST_SUB get their own bucket, and every
+ * power of two above that is split into HIST_SUB buckets, which keeps the
+ * error within 1/HIST_SUB of the value.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+enum impl {
+	IMPL_SHEAF,
+	/* sheaf, picking the per-CPU structure of the CPU each operation runs
+	 * on rather than one per thread */
+	IMPL_SHEAF_CPU,
+	/* sheaf, through the inline fast paths of sheaf_inline.h */
+	IMPL_SHEAF_INLINE,
+	/* sheaf_multi, with one lane per group of threads */
+	IMPL_SHEAF_MULTI,
+	/* sheaf_queue, enqueuing and dequeuing instead of pushing and
+	 * popping */
+	IMPL_SHEAF_QUEUE,
+	/* sheaf_deque, popping from the own deque of each thread and stealing
+	 * from the others once it is empty */
+	IMPL_SHEAF_DEQUE,
+	IMPL_SPIN,
+	IMPL_MUTEX,
+};
+
+enum role {
+	ROLE_BOTH,
+	ROLE_PUSH,
+	ROLE_POP,
+	ROLE_NR,
+};
+
+struct config {
+	enum impl impl;
+	size_t threads;
+	/* Lanes of sheaf_multi */
+	size_t lanes;
+	/* Operations done by each thread */
+	size_t ops;
+	/* Percentage of pushes, when threads both push and pop */
+	unsigned int ratio;
+	/* Operations of the same kind done in a row */
+	size_t burst;
+	/* Split threads into producers and consumers */
+	int split;
+	int pin;
+	/* Values pushed before the run starts */
+	size_t preload;
+	size_t reps;
+	/* Measure the latency of each operation */
+	int timing;
+	/* Collect hardware counters, and the raw event code for HITM */
+	int counters;
+	uint64_t hitm_raw;
+};
+
+struct bench {
+	struct config *cfg;
+	sheaf_t sheaf;
+	sheaf_multi_t multi;
+	sheaf_queue_t queue;
+	sheaf_deque_t deque;
+	stack_t stack;
+	lock_t lock;
+	pthread_barrier_t barrier;
+	int num_cores;
+};
+
+struct worker {
+	struct bench *bench;
+	size_t id;
+	enum role role;
+	uint32_t seed;
+	/* Completed operations, and pops that found the stack empty */
+	uint64_t ops;
+	uint64_t empty;
+	/* When this thread started and finished its operations */
+	uint64_t start;
+	uint64_t end;
+	uint64_t hist[HIST_BUCKETS];
+	struct perf perf;
+	unsigned int perf_mask;
+	uint64_t perf_vals[PERF_NR_COUNTERS];
+};
+
+/* Hardware counters added up over the threads of one role */
+struct perf_total {
+	uint64_t ops;
+	uint64_t vals[PERF_NR_COUNTERS];
+};
+
+struct results {
+	uint64_t ops;
+	uint64_t empty;
+	uint64_t hist[HIST_BUCKETS];
+	/* Counters that could be opened by every thread */
+	unsigned int perf_mask;
+	struct perf_total perf[ROLE_NR];
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t hist_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < HIST_SUB)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	return (size_t)(msb - HIST_SUB_BITS + 1) * HIST_SUB +
+		   ((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value that falls into a bucket */
+static uint64_t hist_value(size_t bucket)
+{
+	size_t group = bucket / HIST_SUB;
+
+	if (!group)
+		return bucket;
+
+	return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << (group - 1);
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, double q)
+{
+	uint64_t total = 0, target, seen = 0;
+	size_t i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i)
+		total += hist[i];
+	if (!total)
+		return 0;
+
+	target = (uint64_t)ceil(q * (double)total);
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += hist[i];
+		if (seen >= target)
+			break;
+	}
+
+	return hist_value(i);
+}
+
+/* xorshift32 */
+static inline uint32_t rand_next(uint32_t *seed)
+{
+	uint32_t x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+	return x;
+}
+
+static int bench_push(struct bench *b, size_t id, uintptr_t val)
+{
+	node_t *node;
+
+	if (b->cfg->impl == IMPL_SHEAF)
+		return sheaf_push(&b->sheaf, val, id);
+	if (b->cfg->impl == IMPL_SHEAF_CPU)
+		return sheaf_push_cpu(&b->sheaf, val);
+	if (b->cfg->impl == IMPL_SHEAF_INLINE)
+		return sheaf_push_inline(&b->sheaf, val, id);
+	if (b->cfg->impl == IMPL_SHEAF_MULTI)
+		return sheaf_multi_push(&b->multi, val, id);
+	if (b->cfg->impl == IMPL_SHEAF_QUEUE)
+		return sheaf_enqueue(&b->queue, val, id);
+	if (b->cfg->impl == IMPL_SHEAF_DEQUE)
+		return sheaf_deque_push(&b->deque, val, id);
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return -SHEAF_ENOMEM;
+	node->val = val;
+
+	lock_lock(&b->lock);
+	stack_push(&b->stack, node);
+	lock_unlock(&b->lock);
+	return 0;
+}
+
+static int bench_pop(struct bench *b, size_t id)
+{
+	node_t *node;
+
+	if (b->cfg->impl == IMPL_SHEAF)
+		return sheaf_pop(&b->sheaf, NULL, id);
+	if (b->cfg->impl == IMPL_SHEAF_CPU)
+		return sheaf_pop_cpu(&b->sheaf, NULL);
+	if (b->cfg->impl == IMPL_SHEAF_INLINE)
+		return sheaf_pop_inline(&b->sheaf, NULL, id);
+	if (b->cfg->impl == IMPL_SHEAF_MULTI)
+		return sheaf_multi_pop(&b->multi, NULL, id);
+	if (b->cfg->impl == IMPL_SHEAF_QUEUE)
+		return sheaf_dequeue(&b->queue, NULL, id);
+	if (b->cfg->impl == IMPL_SHEAF_DEQUE) {
+		if (!sheaf_deque_pop(&b->deque, NULL, id))
+			return 0;
+		return sheaf_deque_steal(&b->deque, NULL, id);
+	}
+
+	lock_lock(&b->lock);
+	node = stack_pop(&b->stack);
+	lock_unlock(&b->lock);
+
+	if (!node)
+		return -SHEAF_EAGAIN;
+	free(node);
+	return 0;
+}
+
+static void *worker(void *ctx)
+{
+	struct worker *w = ctx;
+	struct bench *b = w->bench;
+	struct config *cfg = b->cfg;
+	uint64_t start = 0;
+	size_t i = 0, j;
+	int push, ret;
+
+	if (cfg->pin)
+		pin_to_core(w->id, b->num_cores);
+	if (cfg->counters)
+		w->perf_mask = perf_open(&w->perf, cfg->hitm_raw);
+
+	barrier_wait(&b->barrier);
+	w->start = now_ns();
+	if (cfg->counters)
+		perf_enable(&w->perf);
+
+	while (i < cfg->ops) {
+		if (w->role == ROLE_BOTH)
+			push = rand_next(&w->seed) % 100 < cfg->ratio;
+		else
+			push = w->role == ROLE_PUSH;
+
+		for (j = 0; j < cfg->burst && i < cfg->ops; ++j) {
+			if (cfg->timing)
+				start = now_ns();
+
+			if (push)
+				ret = bench_push(b, w->id, w->id);
+			else
+				ret = bench_pop(b, w->id);
+
+			/* Consumers retry until they get as many values as the
+			 * producers push */
+			if (ret == -SHEAF_EAGAIN) {
+				w->empty++;
+				if (w->role == ROLE_BOTH)
+					++i;
+				continue;
+			}
+			if (ret)
+				errx(EXIT_FAILURE, "%s: %s", push ? "push" : "pop",
+					 strerror(-ret));
+
+			if (cfg->timing)
+				w->hist[hist_bucket(now_ns() - start)]++;
+			w->ops++;
+			++i;
+		}
+	}
+
+	w->end = now_ns();
+	if (cfg->counters) {
+		perf_disable(&w->perf);
+		perf_read(&w->perf, w->perf_vals);
+		perf_close(&w->perf);
+	}
+
+	return NULL;
+}
+
+static void bench_init(struct bench *b)
+{
+	struct config *cfg = b->cfg;
+	size_t i, ncpus;
+	int ret;
+
+	if (cfg->impl == IMPL_SHEAF || cfg->impl == IMPL_SHEAF_CPU ||
+		cfg->impl == IMPL_SHEAF_INLINE) {
+		ncpus = cfg->threads;
+		if (cfg->impl == IMPL_SHEAF_CPU)
+			ncpus = (size_t)sysconf(_SC_NPROCESSORS_CONF);
+#ifdef SHEAF_NCPUS
+		/* The inline functions no longer check ncpu */
+		if (cfg->impl == IMPL_SHEAF_INLINE) {
+			if (cfg->threads > SHEAF_NCPUS)
+				errx(EXIT_FAILURE, "built for at most %d threads",
+					 SHEAF_NCPUS);
+			ncpus = SHEAF_NCPUS;
+		}
+#endif
+		ret = sheaf_init(&b->sheaf, ncpus, &pa);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_init: %s", strerror(-ret));
+	} else if (cfg->impl == IMPL_SHEAF_MULTI) {
+		ret = sheaf_multi_init(&b->multi, cfg->lanes, cfg->threads, &pa);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_multi_init: %s", strerror(-ret));
+	} else if (cfg->impl == IMPL_SHEAF_QUEUE) {
+		ret = sheaf_queue_init(&b->queue, cfg->threads, &pa);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_queue_init: %s", strerror(-ret));
+	} else if (cfg->impl == IMPL_SHEAF_DEQUE) {
+		ret = sheaf_deque_init(&b->deque, cfg->threads, &pa);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_deque_init: %s", strerror(-ret));
+	} else {
+		b->stack.head = NULL;
+		lock_init(&b->lock, cfg->impl == IMPL_MUTEX);
+	}
+
+	for (i = 0; i < cfg->preload; ++i) {
+		ret = bench_push(b, 0, 0);
+		if (ret)
+			errx(EXIT_FAILURE, "preload: %s", strerror(-ret));
+	}
+}
+
+static void bench_release(struct bench *b)
+{
+	if (b->cfg->impl == IMPL_SHEAF || b->cfg->impl == IMPL_SHEAF_CPU ||
+		b->cfg->impl == IMPL_SHEAF_INLINE) {
+		sheaf_release(&b->sheaf);
+	} else if (b->cfg->impl == IMPL_SHEAF_MULTI) {
+		sheaf_multi_release(&b->multi);
+	} else if (b->cfg->impl == IMPL_SHEAF_QUEUE) {
+		sheaf_queue_release(&b->queue);
+	} else if (b->cfg->impl == IMPL_SHEAF_DEQUE) {
+		sheaf_deque_release(&b->deque);
+	} else {
+		lock_destroy(&b->lock);
+		stack_release(&b->stack);
+	}
+}
+
+/* Run once, adding up the results of every thread into res. Returns the
+ * wall-clock time of the run, in seconds */
+static double bench_run(struct bench *b, struct results *res)
+{
+	struct config *cfg = b->cfg;
+	struct worker *workers;
+	pthread_t *thrds;
+	uint64_t start = UINT64_MAX, end = 0;
+	size_t i, j;
+
+	workers = calloc(cfg->threads, sizeof(*workers));
+	thrds = calloc(cfg->threads, sizeof(*thrds));
+	if (!workers || !thrds)
+		err(EXIT_FAILURE, "calloc");
+
+	if (pthread_barrier_init(&b->barrier, NULL, cfg->threads + 1))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	bench_init(b);
+
+	for (i = 0; i < cfg->threads; ++i) {
+		workers[i].bench = b;
+		workers[i].id = i;
+		workers[i].seed = (uint32_t)(i * 2654435761U) | 1;
+		if (cfg->split)
+			workers[i].role = i % 2 ? ROLE_POP : ROLE_PUSH;
+		else
+			workers[i].role = ROLE_BOTH;
+		if (pthread_create(&thrds[i], NULL, worker, &workers[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	barrier_wait(&b->barrier);
+
+	for (i = 0; i < cfg->threads; ++i) {
+		if (pthread_join(thrds[i], NULL))
+			warn("pthread_join");
+	}
+
+	bench_release(b);
+	pthread_barrier_destroy(&b->barrier);
+
+	/* The run lasts from the first thread starting to the last one
+	 * finishing */
+	for (i = 0; i < cfg->threads; ++i) {
+		if (workers[i].start < start)
+			start = workers[i].start;
+		if (workers[i].end > end)
+			end = workers[i].end;
+		res->ops += workers[i].ops;
+		res->empty += workers[i].empty;
+		for (j = 0; j < HIST_BUCKETS; ++j)
+			res->hist[j] += workers[i].hist[j];
+
+		res->perf_mask &= workers[i].perf_mask;
+		res->perf[workers[i].role].ops += workers[i].ops;
+		for (j = 0; j < PERF_NR_COUNTERS; ++j)
+			res->perf[workers[i].role].vals[j] += workers[i].perf_vals[j];
+	}
+
+	free(thrds);
+	free(workers);
+
+	return (double)(end - start) / 1e9;
+}
+
+/* Counters are normalized per operation over all threads, and separately over
+ * producers and consumers when they are split */
+static const char *const perf_groups[] = { "op", "push", "pop" };
+
+static void print_perf_header(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < sizeof(perf_groups) / sizeof(*perf_groups); ++i) {
+		for (j = 0; j < PERF_NR_COUNTERS; ++j)
+			printf(",%s_per_%s", perf_counter_names[j], perf_groups[i]);
+	}
+}
+
+static void print_perf(const struct results *res)
+{
+	struct perf_total group[3] = { 0 };
+	size_t i, j;
+
+	for (i = 0; i < ROLE_NR; ++i) {
+		group[0].ops += res->perf[i].ops;
+		for (j = 0; j < PERF_NR_COUNTERS; ++j)
+			group[0].vals[j] += res->perf[i].vals[j];
+	}
+	group[1] = res->perf[ROLE_PUSH];
+	group[2] = res->perf[ROLE_POP];
+
+	/* Leave out counters that are not available */
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < PERF_NR_COUNTERS; ++j) {
+			if (!(res->perf_mask & (1U << j)) || !group[i].ops)
+				printf(",");
+			else
+				printf(",%.3f",
+					   (double)group[i].vals[j] / (double)group[i].ops);
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -i <impl>     sheaf, sheaf-cpu, sheaf-inline, sheaf-multi, "
+			"sheaf-queue,\n"
+			"                sheaf-deque, spin or mutex (default: sheaf)\n"
+			"  -k <lanes>    lanes of sheaf-multi (default: 4)\n"
+			"  -t <threads>  number of threads (default: 4)\n"
+			"  -n <ops>      operations per thread (default: 1048576)\n"
+			"  -r <ratio>    percentage of pushes (default: 50)\n"
+			"  -b <burst>    operations of the same kind in a row "
+			"(default: 1)\n"
+			"  -s            split threads into producers and consumers\n"
+			"  -p            pin each thread to a core\n"
+			"  -l <depth>    values pushed before the run (default: 0)\n"
+			"  -R <reps>     number of runs (default: 1)\n"
+			"  -L            do not measure latency\n"
+			"  -c            collect hardware counters\n"
+			"  -x <event>    raw event code counting HITM loads, e.g. "
+			"0x04d2 on Skylake\n"
+			"  -H            print the CSV header\n",
+			prog);
+	exit(EXIT_FAILURE);
+}
+
+static size_t parse_size(const char *arg, const char *prog)
+{
+	char *end;
+	unsigned long long val;
+
+	val = strtoull(arg, &end, 0);
+	if (*arg == '-' || *end)
+		usage(prog);
+
+	return (size_t)val;
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.impl = IMPL_SHEAF,
+		.threads = 4,
+		.lanes = 4,
+		.ops = 1 << 20,
+		.ratio = 50,
+		.burst = 1,
+		.reps = 1,
+		.timing = 1,
+	};
+	struct bench b = { .cfg = &cfg };
+	static struct results res = { .perf_mask = ~0U };
+	double secs, mean = 0, var = 0, *runs;
+	char impl[32];
+	int opt, header = 0, yield;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "i:k:t:n:r:b:spl:R:Lcx:Hh")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (!strcmp(optarg, "sheaf"))
+				cfg.impl = IMPL_SHEAF;
+			else if (!strcmp(optarg, "sheaf-cpu"))
+				cfg.impl = IMPL_SHEAF_CPU;
+			else if (!strcmp(optarg, "sheaf-inline"))
+				cfg.impl = IMPL_SHEAF_INLINE;
+			else if (!strcmp(optarg, "sheaf-multi"))
+				cfg.impl = IMPL_SHEAF_MULTI;
+			else if (!strcmp(optarg, "sheaf-queue"))
+				cfg.impl = IMPL_SHEAF_QUEUE;
+			else if (!strcmp(optarg, "sheaf-deque"))
+				cfg.impl = IMPL_SHEAF_DEQUE;
+			else if (!strcmp(optarg, "spin"))
+				cfg.impl = IMPL_SPIN;
+			else if (!strcmp(optarg, "mutex"))
+				cfg.impl = IMPL_MUTEX;
+			else
+				usage(argv[0]);
+			break;
+		case 'k':
+			cfg.lanes = parse_size(optarg, argv[0]);
+			break;
+		case 't':
+			cfg.threads = parse_size(optarg, argv[0]);
+			break;
+		case 'n':
+			cfg.ops = parse_size(optarg, argv[0]);
+			break;
+		case 'r':
+			cfg.ratio = (unsigned int)parse_size(optarg, argv[0]);
+			break;
+		case 'b':
+			cfg.burst = parse_size(optarg, argv[0]);
+			break;
+		case 's':
+			cfg.split = 1;
+			break;
+		case 'p':
+			cfg.pin = 1;
+			break;
+		case 'l':
+			cfg.preload = parse_size(optarg, argv[0]);
+			break;
+		case 'R':
+			cfg.reps = parse_size(optarg, argv[0]);
+			break;
+		case 'L':
+			cfg.timing = 0;
+			break;
+		case 'c':
+			cfg.counters = 1;
+			break;
+		case 'x':
+			cfg.hitm_raw = parse_size(optarg, argv[0]);
+			break;
+		case 'H':
+			header = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg.threads || !cfg.lanes || !cfg.burst || !cfg.reps ||
+		cfg.ratio > 100)
+		usage(argv[0]);
+	if (cfg.split && cfg.threads % 2)
+		errx(EXIT_FAILURE, "-s needs an even number of threads");
+
+	b.num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (b.num_cores <= 0)
+		err(EXIT_FAILURE, "sysconf(_SC_NPROCESSORS_ONLN)");
+
+	runs = calloc(cfg.reps, sizeof(*runs));
+	if (!runs)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < cfg.reps; ++i) {
+		runs[i] = bench_run(&b, &res);
+		mean += runs[i];
+	}
+	mean /= (double)cfg.reps;
+	for (i = 0; i < cfg.reps; ++i)
+		var += (runs[i] - mean) * (runs[i] - mean);
+	var /= (double)cfg.reps;
+	free(runs);
+
+	/* Name the implementations and relax strategies the same way as
+	 * scripts/bench.sh, so that scripts/plot.py can read either */
+	switch (cfg.impl) {
+	case IMPL_SHEAF:
+		snprintf(impl, sizeof(impl), "%s", SHEAF_IMPL);
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SHEAF_CPU:
+		snprintf(impl, sizeof(impl), "%s-cpu", SHEAF_IMPL);
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SHEAF_INLINE:
+		snprintf(impl, sizeof(impl), "%s-inline", SHEAF_IMPL);
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SHEAF_MULTI:
+		snprintf(impl, sizeof(impl), "%s-multi%zu", SHEAF_IMPL, cfg.lanes);
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SHEAF_QUEUE:
+		snprintf(impl, sizeof(impl), "sheaf-queue");
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SHEAF_DEQUE:
+		snprintf(impl, sizeof(impl), "sheaf-deque");
+		yield = SHEAF_YIELD;
+		break;
+	case IMPL_SPIN:
+		snprintf(impl, sizeof(impl), "baseline");
+		yield = 0;
+		break;
+	default:
+		snprintf(impl, sizeof(impl), "baseline");
+		yield = 1;
+		break;
+	}
+
+	secs = mean * (double)cfg.reps;
+
+	if (header) {
+		printf("parameter_impl,parameter_threads,parameter_yield,"
+			   "parameter_mode,parameter_ratio,parameter_burst,"
+			   "parameter_preload,parameter_page_size,mean,stddev,"
+			   "ops_per_sec,empty_pops,p50_ns,p99_ns,p999_ns");
+		print_perf_header();
+		printf("\n");
+	}
+
+	if (cfg.counters && !res.perf_mask)
+		warnx("no hardware counters available");
+
+	printf("%s,%zu,%d,%s,%u,%zu,%zu,%#lx,%f,%f,%f,%" PRIu64 ",", impl,
+		   cfg.threads, yield, cfg.split ? "split" : "symmetric", cfg.ratio,
+		   cfg.burst, cfg.preload, (unsigned long)PAGE_SIZE, mean, sqrt(var),
+		   (double)res.ops / secs, res.empty);
+	if (cfg.timing)
+		printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+			   hist_percentile(res.hist, 0.5), hist_percentile(res.hist, 0.99),
+			   hist_percentile(res.hist, 0.999));
+	else
+		printf(",,");
+	if (cfg.counters)
+		print_perf(&res);
+	else
+		print_perf(&(struct results){ 0 });
+	printf("\n");
+
+	return EXIT_SUCCESS;
+}
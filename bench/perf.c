@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+const char *const perf_counter_names[PERF_NR_COUNTERS] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instructions",
+	[PERF_LLC_MISSES] = "llc_misses",
+	[PERF_HITM] = "hitm",
+	[PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static int perf_open_one(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+					   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+unsigned int perf_open(struct perf *perf, uint64_t hitm_raw)
+{
+	unsigned int i, mask = 0;
+
+	perf->fd[PERF_CYCLES] =
+		perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	perf->fd[PERF_INSTRUCTIONS] =
+		perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	perf->fd[PERF_LLC_MISSES] =
+		perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perf->fd[PERF_HITM] = hitm_raw ? perf_open_one(PERF_TYPE_RAW, hitm_raw) :
+									 -1;
+	perf->fd[PERF_BRANCH_MISSES] =
+		perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] >= 0)
+			mask |= 1U << i;
+	}
+
+	return mask;
+}
+
+void perf_enable(struct perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] >= 0)
+			ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+	}
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] >= 0)
+			ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void perf_disable(struct perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] >= 0)
+			ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+}
+
+void perf_read(struct perf *perf, uint64_t *vals)
+{
+	/* value, time enabled, time running */
+	uint64_t buf[3];
+	unsigned int i;
+
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] < 0)
+			continue;
+		if (read(perf->fd[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+			continue;
+
+		/* Extrapolate if the counter did not run all the time */
+		if (buf[2] < buf[1])
+			buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+		vals[i] += buf[0];
+	}
+}
+
+void perf_close(struct perf *perf)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf->fd[i] >= 0)
+			close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+}
+
+#else
+
+unsigned int perf_open(struct perf *perf, uint64_t hitm_raw)
+{
+	unsigned int i;
+
+	(void)hitm_raw;
+	for (i = 0; i < PERF_NR_COUNTERS; ++i)
+		perf->fd[i] = -1;
+
+	return 0;
+}
+
+void perf_enable(struct perf *perf)
+{
+	(void)perf;
+}
+
+void perf_disable(struct perf *perf)
+{
+	(void)perf;
+}
+
+void perf_read(struct perf *perf, uint64_t *vals)
+{
+	(void)perf;
+	(void)vals;
+}
+
+void perf_close(struct perf *perf)
+{
+	(void)perf;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef _SHEAF_BENCH_PERF_H
+#define _SHEAF_BENCH_PERF_H
+
+#include <stdint.h>
+
+/* Hardware counters collected by each benchmark thread */
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	/* Loads served by a modified line in another core's cache. There is
+	 * no generic event for this, so it needs a raw event code */
+	PERF_HITM,
+	PERF_BRANCH_MISSES,
+	PERF_NR_COUNTERS,
+};
+
+extern const char *const perf_counter_names[PERF_NR_COUNTERS];
+
+struct perf {
+	int fd[PERF_NR_COUNTERS];
+};
+
+/*
+ * Open the counters for the calling thread. Counters that cannot be opened,
+ * e.g. because of perf_event_paranoid or a missing PMU, are left out. A zero
+ * hitm_raw leaves out PERF_HITM. Returns a mask of the counters opened.
+ */
+unsigned int perf_open(struct perf *perf, uint64_t hitm_raw);
+void perf_enable(struct perf *perf);
+void perf_disable(struct perf *perf);
+/* Add the value of each open counter to vals, scaled if it was multiplexed */
+void perf_read(struct perf *perf, uint64_t *vals);
+void perf_close(struct perf *perf);
+
+#endif
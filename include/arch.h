@@ -2,6 +2,14 @@
 #ifndef __SHEAF_ARCH
 #define __SHEAF_ARCH
 
+#include <stdint.h>
+
+/* Two adjacent words updated together, aligned to their combined size */
+typedef struct {
+	uint64_t lo;
+	uint64_t hi;
+} __attribute__((aligned(16))) __sheaf_dword_t;
+
 #if defined(__x86_64__) || defined(__i386__)
 
 #include <immintrin.h>
@@ -11,6 +19,29 @@ static inline void __sheaf_arch_relax(void)
 	_mm_pause();
 }
 
+#if defined(__x86_64__)
+
+#define __SHEAF_ARCH_DWCAS
+
+/*
+ * Compare-and-swap both words at once. On failure, exp is updated with the
+ * current value. Full barrier.
+ */
+static inline int __sheaf_arch_dwcas(__sheaf_dword_t *ptr, __sheaf_dword_t *exp,
+									 __sheaf_dword_t new)
+{
+	uint8_t ok;
+
+	__asm__ volatile("lock cmpxchg16b %1\n\t"
+					 "sete %0"
+					 : "=q"(ok), "+m"(*ptr), "+a"(exp->lo), "+d"(exp->hi)
+					 : "b"(new.lo), "c"(new.hi)
+					 : "memory", "cc");
+	return ok;
+}
+
+#endif
+
 #elif defined(__aarch64__) || defined(_M_ARM64)
 
 static inline void __sheaf_arch_relax(void)
@@ -18,6 +49,68 @@ static inline void __sheaf_arch_relax(void)
 	__asm__ volatile("isb sy" ::: "memory");
 }
 
+#define __SHEAF_ARCH_DWCAS
+
+#if defined(__ARM_FEATURE_ATOMICS)
+
+/* LSE: a single compare-and-swap pair, with acquire and release semantics */
+static inline int __sheaf_arch_dwcas(__sheaf_dword_t *ptr, __sheaf_dword_t *exp,
+									 __sheaf_dword_t new)
+{
+	/* casp works on pairs of consecutive registers, starting at an even
+	 * one */
+	register uint64_t lo __asm__("x0") = exp->lo;
+	register uint64_t hi __asm__("x1") = exp->hi;
+	register uint64_t new_lo __asm__("x2") = new.lo;
+	register uint64_t new_hi __asm__("x3") = new.hi;
+	uint64_t exp_lo = exp->lo, exp_hi = exp->hi;
+
+	__asm__ volatile("caspal %0, %1, %3, %4, %2"
+					 : "+r"(lo), "+r"(hi), "+Q"(*ptr)
+					 : "r"(new_lo), "r"(new_hi)
+					 : "memory");
+
+	exp->lo = lo;
+	exp->hi = hi;
+	return lo == exp_lo && hi == exp_hi;
+}
+
+#else
+
+/*
+ * Exclusive load and store pair, retried until the store succeeds. The whole
+ * loop is a single asm block, so that the compiler cannot put loads or stores
+ * between the exclusive pair, which may clear the monitor forever.
+ */
+static inline int __sheaf_arch_dwcas(__sheaf_dword_t *ptr, __sheaf_dword_t *exp,
+									 __sheaf_dword_t new)
+{
+	uint64_t lo, hi;
+	uint32_t fail;
+
+	__asm__ volatile("1:	ldaxp	%0, %1, %3\n\t"
+					 "cmp	%0, %4\n\t"
+					 "ccmp	%1, %5, #0, eq\n\t"
+					 "b.ne	2f\n\t"
+					 "stlxp	%w2, %6, %7, %3\n\t"
+					 "cbnz	%w2, 1b\n\t"
+					 "b	3f\n"
+					 "2:	clrex\n"
+					 "3:"
+					 : "=&r"(lo), "=&r"(hi), "=&r"(fail), "+Q"(*ptr)
+					 : "r"(exp->lo), "r"(exp->hi), "r"(new.lo), "r"(new.hi)
+					 : "memory", "cc");
+
+	if (lo == exp->lo && hi == exp->hi)
+		return 1;
+
+	exp->lo = lo;
+	exp->hi = hi;
+	return 0;
+}
+
+#endif
+
 #elif defined(__riscv__)
 
 static inline void __sheaf_arch_relax(void)
@@ -33,4 +126,25 @@ static inline void __sheaf_arch_relax(void)
 
 #endif
 
+#ifdef __SHEAF_ARCH_DWCAS
+
+/*
+ * Load both words, one at a time. Each word is a value it really held, but the
+ * pair may mix two different values. Such a pair is only good for the expected
+ * value of a subsequent __sheaf_arch_dwcas(), that will fail and return the
+ * real one, or for looking at either word on its own: the top of a head may
+ * come from a newer value than its counter, and must be dereferenced under the
+ * read lock like any other stale top.
+ */
+static inline __sheaf_dword_t __sheaf_arch_dwload(__sheaf_dword_t *ptr)
+{
+	__sheaf_dword_t val;
+
+	val.lo = __atomic_load_n(&ptr->lo, __ATOMIC_ACQUIRE);
+	val.hi = __atomic_load_n(&ptr->hi, __ATOMIC_ACQUIRE);
+	return val;
+}
+
+#endif
+
 #endif /* __SHEAF_ARCH  */
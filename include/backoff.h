@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_BACKOFF
+#define __SHEAF_BACKOFF
+
+#include <stdint.h>
+
+#include "arch.h"
+#include "os.h"
+
+/* Smallest and largest backoff window, in spins */
+#ifndef SHEAF_BACKOFF_MIN
+#define SHEAF_BACKOFF_MIN 1
+#endif
+
+#ifndef SHEAF_BACKOFF_MAX
+#define SHEAF_BACKOFF_MAX 1024
+#endif
+
+/* Window from which we yield to the scheduler instead of spinning. Set to 0
+ * to always spin */
+#ifndef SHEAF_BACKOFF_YIELD
+#define SHEAF_BACKOFF_YIELD 0
+#endif
+
+struct sheaf_backoff {
+	/* Current backoff window, in spins */
+	uint32_t window;
+	/* State of the random number generator */
+	uint32_t seed;
+};
+
+static inline void __sheaf_backoff_init(struct sheaf_backoff *bo, size_t seed)
+{
+	bo->window = SHEAF_BACKOFF_MIN;
+	/* The generator gets stuck on zero */
+	bo->seed = (uint32_t)(seed * 2654435761U) | 1;
+}
+
+/* xorshift32 */
+static inline uint32_t __sheaf_backoff_rand(struct sheaf_backoff *bo)
+{
+	uint32_t x = bo->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	bo->seed = x;
+	return x;
+}
+
+/*
+ * Called after a failed attempt. Spin for a random number of steps within the
+ * current window, then double the window for the next failure.
+ */
+static inline void __sheaf_backoff_relax(struct sheaf_backoff *bo)
+{
+	uint32_t i, spins;
+
+#if SHEAF_BACKOFF_YIELD > 0
+	if (bo->window >= SHEAF_BACKOFF_YIELD) {
+		__sheaf_os_relax();
+		goto out;
+	}
+#endif
+
+	spins = __sheaf_backoff_rand(bo) % bo->window + 1;
+	for (i = 0; i < spins; ++i)
+		__sheaf_arch_relax();
+
+#if SHEAF_BACKOFF_YIELD > 0
+out:
+#endif
+
+	/* Capped, as the bounds need not be powers of two */
+	if (bo->window > SHEAF_BACKOFF_MAX / 2)
+		bo->window = SHEAF_BACKOFF_MAX;
+	else
+		bo->window <<= 1;
+}
+
+/*
+ * Called after a successful attempt. Halve the window, so that it follows the
+ * rate of failed attempts seen recently by this CPU.
+ */
+static inline void __sheaf_backoff_done(struct sheaf_backoff *bo)
+{
+	if (bo->window < SHEAF_BACKOFF_MIN * 2)
+		bo->window = SHEAF_BACKOFF_MIN;
+	else
+		bo->window >>= 1;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_DEQUE_H
+#define __SHEAF_DEQUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "sheaf.h"
+
+/*
+ * Work-stealing deques after Chase and Lev, one per CPU. The owner of a deque
+ * pushes and pops at its bottom without any atomic read-modify-write, except
+ * to take the last value. Other CPUs steal from its top.
+ *
+ * Values are kept in a buffer of pages from the page allocator, allocated on
+ * the first push and doubled when full. Thieves may still read a buffer after
+ * it was replaced, so replaced buffers are only given back on release. They
+ * take up at most as much as the current one.
+ */
+
+/* A buffer of values, indexed modulo its size */
+struct sheaf_deque_buf {
+	/* Number of slots minus one. The number of slots is a power of two */
+	size_t mask;
+	/* Buffer this one replaced */
+	struct sheaf_deque_buf *prev;
+	/* Pages of slots */
+	_Atomic uintptr_t *pages[];
+};
+
+#define SHEAF_DEQUE_SLOTS_PER_PAGE (PAGE_SIZE / sizeof(uintptr_t))
+
+/* Number of pages a buffer can point to at most, a power of two */
+#define SHEAF_DEQUE_MAX_PAGES (PAGE_SIZE / 2 / sizeof(uintptr_t))
+
+_Static_assert(offsetof(struct sheaf_deque_buf, pages) +
+					   SHEAF_DEQUE_MAX_PAGES * sizeof(uintptr_t) <=
+				   PAGE_SIZE,
+			   "deque buffer does not fit in a page");
+
+/* Maximum number of values in a deque */
+#define SHEAF_DEQUE_MAX (SHEAF_DEQUE_MAX_PAGES * SHEAF_DEQUE_SLOTS_PER_PAGE)
+
+/* The deque of a CPU */
+struct sheaf_deque_cpu {
+	/* Index of the oldest value, advanced by thieves and by the owner
+	 * taking the last value */
+	_Atomic int64_t top __attribute__((aligned(64)));
+	/* Index after the newest value, only written by the owner */
+	_Atomic int64_t bottom __attribute__((aligned(64)));
+	/* Current buffer, NULL until the first push */
+	struct sheaf_deque_buf *_Atomic buf;
+};
+
+#define SHEAF_DEQUE_PER_PAGE (PAGE_SIZE / sizeof(struct sheaf_deque_cpu))
+
+/* Maximum number of CPUs a deque can be created with */
+#define SHEAF_DEQUE_MAX_CPUS                                                \
+	(PAGE_SIZE / sizeof(struct sheaf_deque_cpu *) * SHEAF_DEQUE_PER_PAGE)
+
+struct sheaf_deque {
+	/* Page of pointers to the pages holding the per-CPU deques */
+	struct sheaf_deque_cpu **pages;
+	/* Number of per-CPU deques */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_deque sheaf_deque_t;
+
+int sheaf_deque_init(sheaf_deque_t *deque, size_t ncpus, pa_t *pa);
+void sheaf_deque_release(sheaf_deque_t *deque);
+int sheaf_deque_push(sheaf_deque_t *deque, uintptr_t val, size_t ncpu);
+int sheaf_deque_pop(sheaf_deque_t *deque, uintptr_t *val, size_t ncpu);
+int sheaf_deque_steal(sheaf_deque_t *deque, uintptr_t *val, size_t ncpu);
+
+#endif
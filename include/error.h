@@ -5,5 +5,6 @@
 #define SHEAF_EAGAIN 11
 #define SHEAF_ENOMEM 12
 #define SHEAF_EINVAL 22
+#define SHEAF_ETIMEDOUT 110
 
 #endif
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_IRQ
+#define __SHEAF_IRQ
+
+/*
+ * Hooks used with SHEAF_IRQSAFE to keep interrupt handlers out of the few
+ * per-CPU paths that are not reentrant, none of which is on the push and pop
+ * fast paths: shrinking and the page table lock. On POSIX systems they block
+ * signals. Other targets must define __SHEAF_IRQ_EXTERN and provide them,
+ * e.g. to mask interrupts on bare metal.
+ */
+#if defined(__SHEAF_IRQ_EXTERN) || !defined(__unix__)
+typedef unsigned long __sheaf_irq_flags_t;
+#else
+#include <signal.h>
+typedef sigset_t __sheaf_irq_flags_t;
+#endif
+
+/* Keep interrupt handlers from running on this CPU, saving the previous state
+ * in flags */
+void __sheaf_irq_save(__sheaf_irq_flags_t *flags);
+
+/* Restore the state saved by __sheaf_irq_save() */
+void __sheaf_irq_restore(const __sheaf_irq_flags_t *flags);
+
+#endif
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_LANES_H
+#define __SHEAF_LANES_H
+
+#include "sheaf.h"
+
+/*
+ * Heads of structures made of several stacks that share the nodes of a single
+ * per-CPU directory, such as the lanes of sheaf_multi_t or the levels of
+ * sheaf_prio_t. Each head has a cache line of its own, and all of them fit in
+ * a page.
+ */
+
+struct sheaf_lane {
+	/* Head of the lane */
+	sheaf_atomic_head_t head;
+} __attribute__((aligned(64)));
+
+/* Maximum number of lanes, which all fit in a page */
+#define SHEAF_MAX_LANES (PAGE_SIZE / sizeof(struct sheaf_lane))
+
+/* Allocate a page of nlanes empty lanes, and a directory of ncpus CPUs for
+ * their nodes */
+int sheaf_lanes_init(struct sheaf_lane **lanes, struct percpu_dir **dir,
+					 size_t nlanes, size_t ncpus, pa_t *pa);
+
+/* Free the nodes left in the lanes, then the directory and the lanes. Nobody
+ * else may use them anymore */
+void sheaf_lanes_release(struct sheaf_lane *lanes, struct percpu_dir *dir,
+						 size_t nlanes, pa_t *pa);
+
+#endif
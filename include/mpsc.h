@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_MPSC_H
+#define __SHEAF_MPSC_H
+
+#include "sheaf.h"
+
+/*
+ * A stack with any number of producers but a single consumer, e.g. completions
+ * pushed by workers and drained by one thread. Only the consumer pops, so a
+ * node cannot be popped and pushed again while a pop looks at it: the head is
+ * a plain pointer updated with a single-word CAS, and sheaf_mpsc_pop_all() is a
+ * single exchange.
+ */
+struct sheaf_mpsc {
+	/* First node of the stack */
+	_Atomic(sheaf_node_t *) top __attribute__((aligned(64)));
+	/* Per-CPU directory */
+	struct percpu_dir *percpu __attribute__((aligned(64)));
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_mpsc sheaf_mpsc_t;
+
+int sheaf_mpsc_init(sheaf_mpsc_t *stack, size_t ncpus, pa_t *pa);
+void sheaf_mpsc_release(sheaf_mpsc_t *stack);
+int sheaf_mpsc_push(sheaf_mpsc_t *stack, uintptr_t val, size_t ncpu);
+/* Only ever called by the consumer */
+int sheaf_mpsc_pop(sheaf_mpsc_t *stack, uintptr_t *val, size_t ncpu);
+int sheaf_mpsc_pop_all(sheaf_mpsc_t *stack, void (*fn)(uintptr_t, void *),
+					   void *opaque, size_t ncpu);
+
+#endif
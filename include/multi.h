@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_MULTI_H
+#define __SHEAF_MULTI_H
+
+#include "lanes.h"
+
+/*
+ * A stack split into several lanes, each with its own head, sharing the nodes
+ * of a single per-CPU directory. Pushes go to the lane of the caller, and pops
+ * try it first before moving on to the others. This spreads the updates of the
+ * head over several cache lines, at the cost of a relaxed order: a pop returns
+ * the value last pushed to some lane, not to the whole stack, and may find the
+ * stack empty while a value is being pushed to a lane it already looked at.
+ */
+
+/* Maximum number of lanes */
+#define SHEAF_MULTI_MAX_LANES SHEAF_MAX_LANES
+
+struct sheaf_multi {
+	/* Lanes, in a page of their own */
+	struct sheaf_lane *lanes;
+	/* Number of lanes */
+	size_t nlanes;
+	/* Per-CPU directory, shared by all lanes */
+	struct percpu_dir *percpu;
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_multi sheaf_multi_t;
+
+int sheaf_multi_init(sheaf_multi_t *stack, size_t nlanes, size_t ncpus,
+					 pa_t *pa);
+void sheaf_multi_release(sheaf_multi_t *stack);
+int sheaf_multi_push(sheaf_multi_t *stack, uintptr_t val, size_t ncpu);
+int sheaf_multi_pop(sheaf_multi_t *stack, uintptr_t *val, size_t ncpu);
+
+#endif
@@ -2,6 +2,8 @@
 #ifndef __SHEAF_OS
 #define __SHEAF_OS
 
+#include <stddef.h>
+
 #if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__) || \
 		defined(__OpenBSD__) || defined(__NetBSD__)
 
@@ -12,6 +14,13 @@ static inline void __sheaf_os_relax(void)
 	sched_yield();
 }
 
+/* CPU the calling thread runs on. Linux reads it from the kernel in sheaf.c,
+ * the others have no portable way to tell */
+static inline size_t __sheaf_os_cpu(void)
+{
+	return 0;
+}
+
 #elif defined(__WIN32)
 
 #include <windows.h>
@@ -20,12 +29,23 @@ static inline void __sheaf_os_relax(void)
 {
 	SwitchToThread();
 }
+
+static inline size_t __sheaf_os_cpu(void)
+{
+	return GetCurrentProcessorNumber();
+}
+
 #else
 
 static inline void __sheaf_os_relax(void)
 {
 }
 
+static inline size_t __sheaf_os_cpu(void)
+{
+	return 0;
+}
+
 #endif
 
 #endif
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_PARK
+#define __SHEAF_PARK
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Hooks used by sheaf_pop_wait() to sleep on an empty stack. On Linux they use
+ * a futex. Elsewhere, parking yields to the scheduler through
+ * __sheaf_os_relax() and waking does nothing. Define __SHEAF_PARK_EXTERN to
+ * provide them instead, e.g. on bare metal.
+ */
+
+/* Sleep while *word is val, for at most timeout_ns nanoseconds, or without a
+ * timeout if it is UINT64_MAX. Returning early, e.g. on a spurious wake up, is
+ * fine */
+void __sheaf_park(_Atomic uint32_t *word, uint32_t val, uint64_t timeout_ns);
+
+/* Wake up at most n threads sleeping on word */
+void __sheaf_wake(_Atomic uint32_t *word, uint32_t n);
+
+/* Current time in nanoseconds, from any monotonic clock */
+uint64_t __sheaf_clock_ns(void);
+
+#endif
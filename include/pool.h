@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_POOL_H
+#define __SHEAF_POOL_H
+
+#include "sheaf.h"
+
+/*
+ * A pool of fixed-size objects, handed out by the same per-CPU allocator the
+ * stack takes its nodes from. Pages from the page allocator are carved into
+ * objects, each CPU allocates from its own freelist, and objects freed by
+ * another CPU go back to their owner through its deferred ring.
+ *
+ * Objects are aligned to 16 bytes, and their first 16 bytes are overwritten
+ * while they are free. Every object must be freed before the pool is released,
+ * or its page may be leaked.
+ */
+struct sheaf_pool {
+	/* Per-CPU directory */
+	struct percpu_dir *percpu;
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Size of the objects, rounded up to that of sheaf_node_t */
+	size_t size;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_pool sheaf_pool_t;
+
+/* Largest object size a pool can be created with */
+#define SHEAF_POOL_MAX_SIZE SHEAF_MAX_OBJ_SIZE
+
+int sheaf_pool_init(sheaf_pool_t *pool, size_t size, size_t ncpus, pa_t *pa);
+void sheaf_pool_release(sheaf_pool_t *pool);
+int sheaf_pool_alloc(sheaf_pool_t *pool, void **obj, size_t ncpu);
+int sheaf_pool_free(sheaf_pool_t *pool, void *obj, size_t ncpu);
+int sheaf_pool_alloc_bulk(sheaf_pool_t *pool, void **objs, size_t n,
+						  size_t ncpu);
+int sheaf_pool_free_bulk(sheaf_pool_t *pool, void *const *objs, size_t n,
+						 size_t ncpu);
+int sheaf_pool_shrink(sheaf_pool_t *pool, size_t ncpu, size_t keep);
+
+#endif
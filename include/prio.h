@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_PRIO_H
+#define __SHEAF_PRIO_H
+
+#include "lanes.h"
+
+/*
+ * A stack per priority level, sharing the nodes of a single per-CPU directory.
+ * A bitmap tells which levels may hold values, so that a pop goes straight to
+ * the highest one, and finds an idle stack empty with a single load. Each
+ * level is LIFO, and values of a higher level always come out first, save for
+ * a value being pushed while the pop looks at the bitmap.
+ */
+
+/* Maximum number of levels, one per bit of the bitmap */
+#define SHEAF_PRIO_MAX_LEVELS 64
+
+_Static_assert(SHEAF_PRIO_MAX_LEVELS <= SHEAF_MAX_LANES,
+			   "Levels do not fit in a page");
+
+struct sheaf_prio {
+	/* Bit i is set while level i may hold values. It is set after pushing
+	 * to an empty level, and cleared by pops that found the level empty */
+	_Atomic uint64_t nonempty __attribute__((aligned(64)));
+	/* Levels, in a page of their own */
+	struct sheaf_lane *levels __attribute__((aligned(64)));
+	/* Number of levels */
+	size_t nlevels;
+	/* Per-CPU directory, shared by all levels */
+	struct percpu_dir *percpu;
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_prio sheaf_prio_t;
+
+int sheaf_prio_init(sheaf_prio_t *stack, size_t nlevels, size_t ncpus,
+					pa_t *pa);
+void sheaf_prio_release(sheaf_prio_t *stack);
+int sheaf_prio_push(sheaf_prio_t *stack, uintptr_t val, size_t level,
+					size_t ncpu);
+int sheaf_prio_pop(sheaf_prio_t *stack, uintptr_t *val, size_t *level,
+				   size_t ncpu);
+
+#endif
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_QUEUE_H
+#define __SHEAF_QUEUE_H
+
+#include "sheaf.h"
+
+/*
+ * A lock-free multi-producer / multi-consumer FIFO queue, after Michael and
+ * Scott, with nodes from the same per-CPU allocator as the stack. The queue
+ * always holds a dummy node in front of the first value. Dequeues retire the
+ * old dummy rather than free it, since others may still be reading it, which
+ * also keeps the head and tail free of ABA problems without a counter.
+ */
+struct sheaf_queue {
+	/* Dummy node in front of the first value */
+	_Atomic(sheaf_node_t *) head __attribute__((aligned(64)));
+	/* Last node, or the one before it while an enqueue is in progress */
+	_Atomic(sheaf_node_t *) tail __attribute__((aligned(64)));
+	/* Per-CPU directory */
+	struct percpu_dir *percpu __attribute__((aligned(64)));
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_queue sheaf_queue_t;
+
+int sheaf_queue_init(sheaf_queue_t *queue, size_t ncpus, pa_t *pa);
+void sheaf_queue_release(sheaf_queue_t *queue);
+int sheaf_enqueue(sheaf_queue_t *queue, uintptr_t val, size_t ncpu);
+int sheaf_dequeue(sheaf_queue_t *queue, uintptr_t *val, size_t ncpu);
+
+#endif
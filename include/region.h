@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_REGION_H
+#define __SHEAF_REGION_H
+
+#include "sheaf.h"
+
+/*
+ * A region of memory carved into pages, typically a shared mapping. Its first
+ * page holds the header below, and the others are handed out by a page
+ * allocator that any process mapping the region can use, so that a stack
+ * built with SHEAF_SHARED can live there entirely. Each process may map the
+ * region at a different address, as long as it is aligned to PAGE_SIZE.
+ *
+ * One process creates the region and the stack in it, using a page of the
+ * region for the sheaf_t itself, and publishes it as the root of the region.
+ * The others attach to the region and look the stack up from the root. Only
+ * the stack is shared this way: the other structures of the library keep
+ * plain pointers, and can only be used by the process that created them.
+ */
+struct sheaf_region {
+	/* SHEAF_REGION_MAGIC once the region is initialized */
+	_Atomic uint64_t magic;
+	/* Number of pages in the region, header included */
+	uint64_t npages;
+	/* Number of the first page never handed out */
+	_Atomic uint64_t next;
+	/* Pages given back, with the number of the first one in the low 32
+	 * bits and an ABA counter in the high ones. Each page links to the
+	 * next through its first word */
+	_Atomic uint64_t free;
+	/* Offset of the root object from the start of the region, or 0 */
+	_Atomic uint64_t root;
+};
+
+#define SHEAF_REGION_MAGIC 0x7368656166726567ULL
+
+int sheaf_region_init(void *base, size_t size);
+int sheaf_region_attach(void *base, size_t size);
+void sheaf_region_pa(void *base, pa_t *pa);
+void *sheaf_region_alloc_page(void *base);
+void sheaf_region_free_page(void *base, void *page);
+void sheaf_region_set_root(void *base, void *obj);
+void *sheaf_region_root(void *base);
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef __SHEAF_H
 #define __SHEAF_H
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -32,26 +33,150 @@ extern void __sheaf_relax(void);
 #elif defined(__SHEAF_RELAX_ARCH)
 #include "arch.h"
 #define __sheaf_relax() __sheaf_arch_relax()
+#elif defined(__SHEAF_RELAX_BACKOFF)
+/* Failed CAS attempts back off per CPU, see percpu_relax(). Plain waits
+ * still use arch */
+#include "backoff.h"
+#define __sheaf_relax() __sheaf_arch_relax()
 #else
 #include "arch.h"
 #define __sheaf_relax() __sheaf_arch_relax()
 #endif
 
+#include "arch.h"
 #include "error.h"
+#include "park.h"
+
+/*
+ * With SHEAF_SHARED, stacks can live in memory shared by several processes,
+ * each of which may map it at a different address. Links between structures
+ * are stored as offsets rather than addresses, and heads refer to nodes by
+ * index. Elimination slots hold plain addresses, so there are none.
+ */
+#ifdef SHEAF_SHARED
+#ifndef SHEAF_INDEX_HEAD
+#define SHEAF_INDEX_HEAD
+#endif
+#if defined(SHEAF_ELIM_SLOTS) && SHEAF_ELIM_SLOTS > 0
+#error "SHEAF_SHARED does not support elimination"
+#endif
+#define SHEAF_ELIM_SLOTS 0
+#endif
+
+/* Number of elimination slots per stack. Set to 0 to disable elimination */
+#ifndef SHEAF_ELIM_SLOTS
+#define SHEAF_ELIM_SLOTS 8
+#endif
+
+/* Number of spins a push waits in an elimination slot for a pop */
+#ifndef SHEAF_ELIM_SPINS
+#define SHEAF_ELIM_SPINS 32
+#endif
+
+/* Number of times sheaf_pop_wait() checks an empty stack before sleeping */
+#ifndef SHEAF_WAIT_SPINS
+#define SHEAF_WAIT_SPINS 128
+#endif
+
+/* Timeout of sheaf_pop_wait() to wait until a value is pushed */
+#define SHEAF_WAIT_FOREVER UINT64_MAX
+
+/* Number of nodes freed to another CPU that are sent back together */
+#ifndef SHEAF_REMOTE_BATCH
+#define SHEAF_REMOTE_BATCH 32
+#endif
+
+/* Number of nodes retired by a CPU before it tries to reuse them */
+#ifndef SHEAF_RETIRE_BATCH
+#define SHEAF_RETIRE_BATCH 64
+#endif
+
+/*
+ * Fields declared with SHEAF_PTR() point to other parts of a stack. With
+ * SHEAF_SHARED they hold the offset of the target from the field itself, so
+ * that they mean the same wherever the memory is mapped, and 0 is NULL. They
+ * are only accessed through sheaf_ptr_get() and sheaf_ptr_set().
+ */
+#ifdef SHEAF_SHARED
+
+typedef intptr_t sheaf_off_t;
+
+#define SHEAF_PTR(type) sheaf_off_t
+
+static inline void *__sheaf_ptr_decode(const void *at, sheaf_off_t off)
+{
+	return off ? (void *)((uintptr_t)at + (uintptr_t)off) : NULL;
+}
+
+static inline sheaf_off_t __sheaf_ptr_encode(const void *at, const void *ptr)
+{
+	return ptr ? (sheaf_off_t)((uintptr_t)ptr - (uintptr_t)at) : 0;
+}
+
+#define sheaf_ptr_get(field) __sheaf_ptr_decode(&(field), (field))
+#define sheaf_ptr_set(field, ptr)                                           \
+	((field) = __sheaf_ptr_encode(&(field), (ptr)))
+
+#else
+
+#define SHEAF_PTR(type) type *
+#define sheaf_ptr_get(field) (field)
+#define sheaf_ptr_set(field, ptr) ((field) = (ptr))
+
+#endif
 
 struct sheaf_node {
-	/* Next free node */
-	struct sheaf_node *next_free;
-	/* Next node in the stack */
-	struct sheaf_node *next;
-	/* CPU number of the owner of this node */
-	size_t ncpu;
+	/* Next node in the stack, or in the freelist. A node is never in both
+	 * at the same time */
+	SHEAF_PTR(struct sheaf_node) next;
 	/* Value stored in the node */
 	uintptr_t val;
 };
 
 typedef struct sheaf_node sheaf_node_t;
 
+static inline sheaf_node_t *sheaf_node_next(sheaf_node_t *node)
+{
+	return sheaf_ptr_get(node->next);
+}
+
+static inline void sheaf_node_set_next(sheaf_node_t *node, sheaf_node_t *next)
+{
+	sheaf_ptr_set(node->next, next);
+}
+
+/* Header of a node page. It takes up the first node slot of the page */
+struct sheaf_page {
+	/* CPU number of the owner of the nodes in this page */
+	size_t ncpu;
+	/* Number of nodes of this page in the owner's freelist. Only the
+	 * owner updates it */
+	uint32_t nfree;
+	/* Number of this page in the page table, with SHEAF_INDEX_HEAD */
+	uint32_t pgno;
+};
+
+_Static_assert(sizeof(struct sheaf_page) <= sizeof(sheaf_node_t),
+			   "page header does not fit in a node slot");
+
+/* Number of usable nodes in a node page */
+#define NODES_PER_PAGE (PAGE_SIZE / sizeof(sheaf_node_t) - 1)
+
+/* Largest object a page can hold after its header, when nodes are used for
+ * objects bigger than sheaf_node_t */
+#define SHEAF_MAX_OBJ_SIZE (PAGE_SIZE - sizeof(sheaf_node_t))
+
+static inline struct sheaf_page *sheaf_node_page(const sheaf_node_t *node)
+{
+	return (struct sheaf_page *)((uintptr_t)node & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+/* CPU number of the owner of a node */
+static inline size_t sheaf_node_owner(const sheaf_node_t *node)
+{
+	return sheaf_node_page(node)->ncpu;
+}
+
 /* Page allocator provided by the user */
 struct pa {
 	void *opaque;
@@ -61,22 +186,216 @@ struct pa {
 
 typedef struct pa pa_t;
 
+#ifdef SHEAF_INDEX_HEAD
+
+/*
+ * Heads refer to nodes by a 32-bit index rather than by address, so that a
+ * head with its ABA counter fits in a single word. The index of a node is the
+ * number its page was given in the page table, times the number of node slots
+ * in a page, plus its slot in the page. Slot 0 holds the page header, which
+ * makes index 0 free to mean NULL.
+ */
+typedef uint32_t sheaf_ref_t;
+
+#define SHEAF_SLOTS_PER_PAGE (PAGE_SIZE / sizeof(sheaf_node_t))
+#define SHEAF_PGTBL_ENTRIES (PAGE_SIZE / sizeof(uintptr_t))
+
+/* Maximum number of node pages, limited by either the index or the two-level
+ * page table */
+#define SHEAF_MAX_PAGES                                                     \
+	((1ULL << 32) / SHEAF_SLOTS_PER_PAGE <                                  \
+			 SHEAF_PGTBL_ENTRIES * SHEAF_PGTBL_ENTRIES ?                    \
+		 (1ULL << 32) / SHEAF_SLOTS_PER_PAGE :                              \
+		 SHEAF_PGTBL_ENTRIES * SHEAF_PGTBL_ENTRIES)
+
+/* The head of the stack, referring to the first node */
+struct sheaf_head {
+	sheaf_ref_t top;
+	uint32_t aba;
+} __attribute__((aligned(8)));
+
+#else
+
+typedef sheaf_node_t *sheaf_ref_t;
+
 /* The head of the stack, pointing to the first node */
 struct sheaf_head {
-	sheaf_node_t *top;
+	sheaf_ref_t top;
 	size_t aba;
 } __attribute__((aligned(16)));
 
+#endif
+
 typedef struct sheaf_head sheaf_head_t;
 
+/*
+ * Heads are only accessed through the functions below. Where arch.h has an
+ * inline double-width CAS, 16-byte heads use it rather than C11 atomics, which
+ * compilers may turn into calls to libatomic, or even into a lock.
+ */
+#if !defined(SHEAF_INDEX_HEAD) && defined(__SHEAF_ARCH_DWCAS)
+
+typedef __sheaf_dword_t sheaf_atomic_head_t;
+
+_Static_assert(sizeof(sheaf_head_t) == sizeof(__sheaf_dword_t),
+			   "head does not fit in a double word");
+
+static inline void sheaf_head_init(sheaf_atomic_head_t *h, sheaf_head_t val)
+{
+	__builtin_memcpy(h, &val, sizeof(val));
+}
+
+static inline sheaf_head_t sheaf_head_load(sheaf_atomic_head_t *h)
+{
+	__sheaf_dword_t dw = __sheaf_arch_dwload(h);
+	sheaf_head_t val;
+
+	__builtin_memcpy(&val, &dw, sizeof(val));
+	return val;
+}
+
+static inline int sheaf_head_cas(sheaf_atomic_head_t *h, sheaf_head_t *exp,
+								 sheaf_head_t new)
+{
+	__sheaf_dword_t dw_exp, dw_new;
+	int ok;
+
+	__builtin_memcpy(&dw_exp, exp, sizeof(*exp));
+	__builtin_memcpy(&dw_new, &new, sizeof(new));
+	ok = __sheaf_arch_dwcas(h, &dw_exp, dw_new);
+	__builtin_memcpy(exp, &dw_exp, sizeof(*exp));
+	return ok;
+}
+
+#else
+
+typedef _Atomic sheaf_head_t sheaf_atomic_head_t;
+
+static inline void sheaf_head_init(sheaf_atomic_head_t *h, sheaf_head_t val)
+{
+	atomic_init(h, val);
+}
+
+static inline sheaf_head_t sheaf_head_load(sheaf_atomic_head_t *h)
+{
+	return atomic_load(h);
+}
+
+static inline int sheaf_head_cas(sheaf_atomic_head_t *h, sheaf_head_t *exp,
+								 sheaf_head_t new)
+{
+	return atomic_compare_exchange_weak(h, exp, new);
+}
+
+#endif
+
 typedef uint32_t idx_t;
 
+/* Counters kept by each CPU when built with SHEAF_STATS */
+struct sheaf_stats {
+	/* Values pushed and popped */
+	uint64_t push;
+	uint64_t pop;
+	/* Pops that found the stack empty */
+	uint64_t pop_empty;
+	/* Failed CAS on the head of the stack, by pushes and by pops */
+	uint64_t push_retry;
+	uint64_t pop_retry;
+	/* Values handed over through the elimination array, counted by both
+	 * the push and the pop of each pair */
+	uint64_t elim_push;
+	uint64_t elim_pop;
+	/* Nodes freed to another CPU */
+	uint64_t remote_free;
+	/* Chains left in the depot because the owner's ring was full */
+	uint64_t ring_full;
+	/* Nodes taken back from the deferred ring */
+	uint64_t deferred;
+	/* Spins waiting for a reserved ring entry to be written */
+	uint64_t ring_wait;
+	/* Node pages allocated from the page allocator */
+	uint64_t page_alloc;
+	/* CPUs found claimed by another thread by the sheaf_*_cpu()
+	 * functions */
+	uint64_t cpu_busy;
+};
+
+struct percpu;
+struct percpu_dir;
+
+/* Entry of a deferred ring buffer, pointing to a chain of nodes */
+#ifdef SHEAF_SHARED
+typedef _Atomic sheaf_off_t sheaf_ring_t;
+#else
+typedef sheaf_node_t *_Atomic sheaf_ring_t;
+#endif
+
+/* Nodes freed to another CPU, waiting to be sent back as a single chain */
+struct percpu_stage {
+	/* The owner of the staged nodes */
+	SHEAF_PTR(struct percpu) dst;
+	/* Chain of staged nodes */
+	SHEAF_PTR(sheaf_node_t) first;
+	/* Number of nodes in the chain */
+	size_t count;
+};
+
+/* Number of stages in the page each CPU keeps them in. They are indexed by
+ * owner CPU, so stacks with up to that many CPUs have a stage for each */
+#define PERCPU_STAGES (PAGE_SIZE / sizeof(struct percpu_stage))
+
 /* A per-CPU structure */
 struct percpu {
+#ifdef SHEAF_IRQSAFE
+	/* Node freelist. An interrupt handler may use it in the middle of an
+	 * operation on the same CPU, so it has an ABA counter */
+	sheaf_atomic_head_t head;
+	/* Read locks taken by interrupt handlers while this CPU already held
+	 * one */
+	_Atomic size_t read_nest;
+	/* Set while this CPU takes nodes back from its deferred ring, while
+	 * it stages a remote free, and while it retires a node */
+	_Atomic int consuming;
+	_Atomic int staging;
+	_Atomic int retiring;
+	/* Nodes retired by interrupt handlers while this CPU was retiring
+	 * one, linked through their value */
+	sheaf_ring_t pending;
+#else
 	/* Node freelist */
-	sheaf_node_t *head;
-	/* Deferred ring buffer */
-	sheaf_node_t *_Atomic *ring;
+	SHEAF_PTR(sheaf_node_t) head;
+#endif
+	/* Set while a thread uses this structure through the sheaf_*_cpu()
+	 * functions */
+	atomic_flag claimed;
+	/* Deferred ring buffer, holding chains of nodes freed by others */
+	SHEAF_PTR(sheaf_ring_t) ring;
+	/* CPU number of this structure */
+	size_t ncpu;
+	/* Directory this structure belongs to */
+	SHEAF_PTR(struct percpu_dir) dir;
+	/* Epoch observed while reading nodes without owning them, with the
+	 * lowest bit set. Zero when not reading */
+	_Atomic size_t active;
+	/* Remote frees being batched, in a page of their own, with a stage for
+	 * each owner CPU up to PERCPU_STAGES */
+	SHEAF_PTR(struct percpu_stage) stage;
+	/* Nodes retired while others might still be reading them, linked
+	 * through their value, and how many there are */
+	SHEAF_PTR(sheaf_node_t) retired;
+	size_t nretired;
+	/* Previous batch of retired nodes, reused once no CPU reads in an
+	 * epoch before limbo_epoch */
+	SHEAF_PTR(sheaf_node_t) limbo;
+	size_t limbo_epoch;
+#ifdef __SHEAF_RELAX_BACKOFF
+	/* Backoff state, adapted to the rate of failed CAS on this CPU */
+	struct sheaf_backoff backoff;
+#endif
+#ifdef SHEAF_STATS
+	/* Counters, away from the indexes written by other CPUs */
+	struct sheaf_stats stats __attribute__((aligned(64)));
+#endif
 	/* Indexes into the ring buffer */
 	_Atomic idx_t push __attribute__((aligned(64)));
 	_Atomic idx_t pop __attribute__((aligned(64)));
@@ -84,28 +403,469 @@ struct percpu {
 
 typedef struct percpu percpu_t;
 
+#ifdef SHEAF_STATS
+/* Only the owner of pc updates its counters, so a plain load and store is
+ * enough. sheaf_stats_read() may see slightly stale values */
+static inline void __sheaf_stat_add(uint64_t *cnt, uint64_t n)
+{
+	__atomic_store_n(cnt, __atomic_load_n(cnt, __ATOMIC_RELAXED) + n,
+					 __ATOMIC_RELAXED);
+}
+
+#define percpu_stat_add(pc, name, n) __sheaf_stat_add(&(pc)->stats.name, (n))
+#else
+#define percpu_stat_add(pc, name, n) ((void)(pc), (void)(n))
+#endif
+
+/* Relax after a failed CAS attempt by the owner of pc */
+static inline void percpu_relax(percpu_t *pc)
+{
+#ifdef __SHEAF_RELAX_BACKOFF
+	__sheaf_backoff_relax(&pc->backoff);
+#else
+	(void)pc;
+	__sheaf_relax();
+#endif
+}
+
+/* Report a successful CAS attempt by the owner of pc */
+static inline void percpu_relax_done(percpu_t *pc)
+{
+#ifdef __SHEAF_RELAX_BACKOFF
+	__sheaf_backoff_done(&pc->backoff);
+#else
+	(void)pc;
+#endif
+}
+
+/*
+ * State shared by all CPUs. It takes up a whole page, the rest of which is
+ * used as a directory: the per-CPU structures are spread over as many pages as
+ * needed, and the directory holds pointers to each of those pages.
+ */
+struct percpu_dir {
+	/* Depot of chains of free nodes, stacked through the value of their
+	 * first node */
+	sheaf_atomic_head_t depot;
+	/* Reclamation epoch, bumped when node pages are given back */
+	_Atomic size_t epoch __attribute__((aligned(64)));
+	/* Page allocator provided by the user, only valid in the process that
+	 * created the directory */
+	pa_t *pa;
+#ifdef SHEAF_SHARED
+	/* Shared region the pages are carved from, if pa is its allocator */
+	SHEAF_PTR(void) region;
+#endif
+	/* Number of per-CPU structures */
+	size_t ncpus;
+	/* Size of the nodes, at least that of sheaf_node_t, and how many of
+	 * them fit in a page after the header */
+	size_t objsize;
+	uint32_t nobjs;
+#ifdef SHEAF_INDEX_HEAD
+	/* Page table, mapping page numbers to node pages. Each entry of the
+	 * top level points to a page of entries */
+	SHEAF_PTR(_Atomic uintptr_t) pgtbl;
+	/* Number of page numbers handed out so far, and list of the ones
+	 * given back, linked through their entries */
+	uint32_t pgtbl_next;
+	uint32_t pgtbl_free;
+	/* Taken when a page is added to or removed from the table */
+	atomic_flag pgtbl_lock;
+#endif
+	/* Pages holding the per-CPU structures */
+	SHEAF_PTR(percpu_t) pages[];
+};
+
+#define PERCPU_PER_PAGE (PAGE_SIZE / sizeof(percpu_t))
+#define PERCPU_DIR_SLOTS                                                    \
+	((PAGE_SIZE - offsetof(struct percpu_dir, pages)) /                     \
+	 sizeof(SHEAF_PTR(percpu_t)))
+
+/* Maximum number of CPUs a stack can be created with */
+#define SHEAF_MAX_CPUS (PERCPU_PER_PAGE * PERCPU_DIR_SLOTS)
+
+static inline percpu_t *percpu_get(struct percpu_dir *dir, size_t ncpu)
+{
+	percpu_t *page = sheaf_ptr_get(dir->pages[ncpu / PERCPU_PER_PAGE]);
+
+	return &page[ncpu % PERCPU_PER_PAGE];
+}
+
+/* Directory a per-CPU structure belongs to */
+static inline struct percpu_dir *percpu_dir_of(percpu_t *pc)
+{
+	return sheaf_ptr_get(pc->dir);
+}
+
+#ifdef SHEAF_INDEX_HEAD
+
+/* Entries of the page table hold the address of a page or, with SHEAF_SHARED,
+ * its offset from the entry. Odd values are not addresses, and kept as is */
+static inline uintptr_t sheaf_pgtbl_load(_Atomic uintptr_t *ent,
+										 memory_order order)
+{
+	uintptr_t val = atomic_load_explicit(ent, order);
+
+#ifdef SHEAF_SHARED
+	if (val && !(val & 1))
+		val += (uintptr_t)ent;
+#endif
+	return val;
+}
+
+static inline void sheaf_pgtbl_store(_Atomic uintptr_t *ent, uintptr_t val,
+									 memory_order order)
+{
+#ifdef SHEAF_SHARED
+	if (val && !(val & 1))
+		val -= (uintptr_t)ent;
+#endif
+	atomic_store_explicit(ent, val, order);
+}
+
+#endif
+
+/* Node referred to by a head */
+static inline sheaf_node_t *sheaf_ref_node(struct percpu_dir *dir,
+										   sheaf_ref_t ref)
+{
+#ifdef SHEAF_INDEX_HEAD
+	size_t pgno = ref / SHEAF_SLOTS_PER_PAGE;
+	_Atomic uintptr_t *top, *leaf;
+
+	if (!ref)
+		return NULL;
+
+	top = sheaf_ptr_get(dir->pgtbl);
+	leaf = (_Atomic uintptr_t *)sheaf_pgtbl_load(
+			&top[pgno / SHEAF_PGTBL_ENTRIES], memory_order_acquire);
+	return (sheaf_node_t *)sheaf_pgtbl_load(&leaf[pgno % SHEAF_PGTBL_ENTRIES],
+											memory_order_relaxed) +
+		   ref % SHEAF_SLOTS_PER_PAGE;
+#else
+	(void)dir;
+	return ref;
+#endif
+}
+
+/* Reference to a node, to be stored in a head */
+static inline sheaf_ref_t sheaf_node_ref(sheaf_node_t *node)
+{
+#ifdef SHEAF_INDEX_HEAD
+	struct sheaf_page *page;
+
+	if (!node)
+		return 0;
+
+	page = sheaf_node_page(node);
+	return (sheaf_ref_t)(page->pgno * SHEAF_SLOTS_PER_PAGE +
+						 (size_t)(node - (sheaf_node_t *)page));
+#else
+	return node;
+#endif
+}
+
+/*
+ * Try once to push the chain of nodes from first to last on h, whose value was
+ * last seen as *head. Returns 1 on success. On failure, *head is updated with
+ * the current value of h.
+ */
+static inline int sheaf_head_try_push(struct percpu_dir *dir,
+									  sheaf_atomic_head_t *h,
+									  sheaf_head_t *head, sheaf_node_t *first,
+									  sheaf_node_t *last)
+{
+	sheaf_head_t new;
+
+	sheaf_node_set_next(last, sheaf_ref_node(dir, head->top));
+	new.top = sheaf_node_ref(first);
+	new.aba = head->aba + 1;
+	return sheaf_head_cas(h, head, new);
+}
+
+/*
+ * Try once to pop up to max nodes off h, whose value was last seen as *head and
+ * is not empty. The caller must hold the read lock. Returns the first node of
+ * the chain taken off, with its length in *n. The last node of the chain still
+ * links to the rest of the stack. On failure, returns NULL and *head is updated
+ * with the current value of h.
+ */
+static inline sheaf_node_t *sheaf_head_try_pop(struct percpu_dir *dir,
+											   sheaf_atomic_head_t *h,
+											   sheaf_head_t *head, size_t max,
+											   size_t *n)
+{
+	sheaf_node_t *first, *node, *next;
+	sheaf_head_t new;
+
+	/* The links we read might be stale if someone else pops concurrently,
+	 * but in that case the ABA counter will have changed and the CAS will
+	 * fail */
+	first = sheaf_ref_node(dir, head->top);
+	node = first;
+	next = sheaf_node_next(node);
+	for (*n = 1; *n < max && next; ++*n) {
+		node = next;
+		next = sheaf_node_next(node);
+	}
+
+	new.top = sheaf_node_ref(next);
+	new.aba = head->aba + 1;
+	if (!sheaf_head_cas(h, head, new))
+		return NULL;
+
+	return first;
+}
+
+/*
+ * Nodes that are not owned, e.g. the top of the stack during a pop, may only
+ * be dereferenced between these two calls. This prevents their page from
+ * being given back to the page allocator in the meantime.
+ */
+static inline void percpu_read_lock(percpu_t *pc)
+{
+	size_t cur;
+
+#ifdef SHEAF_IRQSAFE
+	/* We interrupted a reader on this CPU, whose epoch covers us too */
+	if (atomic_load_explicit(&pc->active, memory_order_relaxed)) {
+		atomic_store_explicit(
+				&pc->read_nest,
+				atomic_load_explicit(&pc->read_nest, memory_order_relaxed) + 1,
+				memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		return;
+	}
+#endif
+
+	cur = atomic_load_explicit(&percpu_dir_of(pc)->epoch,
+							   memory_order_relaxed);
+	atomic_store_explicit(&pc->active, cur | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void percpu_read_unlock(percpu_t *pc)
+{
+#ifdef SHEAF_IRQSAFE
+	size_t nest = atomic_load_explicit(&pc->read_nest, memory_order_relaxed);
+
+	if (nest) {
+		atomic_store_explicit(&pc->read_nest, nest - 1, memory_order_release);
+		return;
+	}
+#endif
+
+	atomic_store_explicit(&pc->active, 0, memory_order_release);
+}
+
+/*
+ * A CPU is the only one to use its freelist. With SHEAF_IRQSAFE, an interrupt
+ * handler on that CPU may use it in the middle of an operation, so the head is
+ * updated with a CAS and the page counters with atomic adds.
+ */
+#ifdef SHEAF_IRQSAFE
+
+static inline void percpu_nfree_add(struct sheaf_page *page, uint32_t n)
+{
+	__atomic_add_fetch(&page->nfree, n, __ATOMIC_RELAXED);
+}
+
+static inline int percpu_has_free(percpu_t *pc)
+{
+	return sheaf_head_load(&pc->head).top != 0;
+}
+
+/* Put a chain of nodes from first to last in the freelist of pc, without
+ * counting them in their pages */
+static inline void percpu_push_free(percpu_t *pc, sheaf_node_t *first,
+									sheaf_node_t *last)
+{
+	sheaf_head_t head = sheaf_head_load(&pc->head);
+
+	while (!sheaf_head_try_push(percpu_dir_of(pc), &pc->head, &head, first,
+								last)) {
+	}
+}
+
+static inline sheaf_node_t *percpu_pop_free(percpu_t *pc)
+{
+	sheaf_head_t head = sheaf_head_load(&pc->head);
+	sheaf_node_t *node = NULL;
+	size_t n;
+
+	/* A handler may take the top, hand it to another CPU, and have its page
+	 * shrunk before we read its link */
+	percpu_read_lock(pc);
+	while (head.top) {
+		node = sheaf_head_try_pop(percpu_dir_of(pc), &pc->head, &head, 1,
+								  &n);
+		if (node)
+			break;
+	}
+	percpu_read_unlock(pc);
+
+	return node;
+}
+
+/* Take the whole freelist of pc */
+static inline sheaf_node_t *percpu_detach_free(percpu_t *pc)
+{
+	sheaf_head_t head = sheaf_head_load(&pc->head), new;
+
+	do {
+		new.top = 0;
+		new.aba = head.aba + 1;
+	} while (!sheaf_head_cas(&pc->head, &head, new));
+
+	return sheaf_ref_node(percpu_dir_of(pc), head.top);
+}
+
+#else
+
+static inline void percpu_nfree_add(struct sheaf_page *page, uint32_t n)
+{
+	page->nfree += n;
+}
+
+static inline int percpu_has_free(percpu_t *pc)
+{
+	return sheaf_ptr_get(pc->head) != NULL;
+}
+
+static inline void percpu_push_free(percpu_t *pc, sheaf_node_t *first,
+									sheaf_node_t *last)
+{
+	sheaf_node_set_next(last, sheaf_ptr_get(pc->head));
+	sheaf_ptr_set(pc->head, first);
+}
+
+static inline sheaf_node_t *percpu_pop_free(percpu_t *pc)
+{
+	sheaf_node_t *node = sheaf_ptr_get(pc->head);
+
+	if (node)
+		sheaf_ptr_set(pc->head, sheaf_node_next(node));
+	return node;
+}
+
+static inline sheaf_node_t *percpu_detach_free(percpu_t *pc)
+{
+	sheaf_node_t *first = sheaf_ptr_get(pc->head);
+
+	sheaf_ptr_set(pc->head, NULL);
+	return first;
+}
+
+#endif
+
+/* Put a node in the freelist of pc */
+static inline void percpu_free_node(percpu_t *pc, sheaf_node_t *node)
+{
+	struct sheaf_page *page = sheaf_node_page(node);
+
+	if (page->ncpu == pc->ncpu)
+		percpu_nfree_add(page, 1);
+
+	percpu_push_free(pc, node, node);
+}
+
+/* Take a node off the freelist of pc, if it is not empty */
+static inline sheaf_node_t *percpu_take_node(percpu_t *pc)
+{
+	sheaf_node_t *node = percpu_pop_free(pc);
+	struct sheaf_page *page;
+
+	if (!node)
+		return NULL;
+
+	page = sheaf_node_page(node);
+	if (page->ncpu == pc->ncpu)
+		percpu_nfree_add(page, (uint32_t)-1);
+
+	return node;
+}
+
+/* A slot where a colliding push and pop can exchange a node */
+struct sheaf_elim {
+	_Atomic(sheaf_node_t *) node;
+} __attribute__((aligned(64)));
+
 struct sheaf {
 	/* Head of the stack */
-	_Atomic sheaf_head_t head;
-	/* Per-CPU array */
-	percpu_t *percpu;
+	sheaf_atomic_head_t head;
+#if SHEAF_ELIM_SLOTS > 0
+	/* Elimination array, used when the head is contended */
+	struct sheaf_elim elim[SHEAF_ELIM_SLOTS];
+#endif
+	/* Per-CPU directory */
+	SHEAF_PTR(struct percpu_dir) percpu;
 	/* Number of items in the percpu array */
 	size_t ncpus;
-	/* Page allocator provided by the user */
+	/* Page allocator provided by the user, only valid in the process that
+	 * created the stack */
 	pa_t *pa;
+	/* Number of threads about to sleep or sleeping in sheaf_pop_wait().
+	 * Pushes only wake them up when it is not zero. On a cache line of its
+	 * own, so that waiters coming and going do not slow down the head */
+	_Atomic uint32_t waiters __attribute__((aligned(64)));
+	/* Word they sleep on, bumped by every push that wakes them */
+	_Atomic uint32_t wake_seq;
 };
 
 typedef struct sheaf sheaf_t;
 
-percpu_t *percpu_init(size_t ncpus, pa_t *pa);
-void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa);
-sheaf_node_t *percpu_alloc_node(percpu_t *percpu, pa_t *pa);
-void percpu_free_node(percpu_t *percpu, sheaf_node_t *node);
+/* Per-CPU directory of a stack */
+static inline struct percpu_dir *sheaf_dir(sheaf_t *stack)
+{
+	return sheaf_ptr_get(stack->percpu);
+}
+
+/*
+ * Wake up to n threads sleeping in sheaf_pop_wait() once values have been
+ * pushed. The CAS that pushed them is ordered before the seq_cst load of
+ * waiters, and sheaf_pop_wait() puts a seq_cst fence between the increment
+ * of waiters and its check of the stack: either we see the waiter, or it
+ * sees the values.
+ */
+static inline void sheaf_wake(sheaf_t *stack, size_t n)
+{
+	if (!atomic_load(&stack->waiters))
+		return;
+
+	atomic_fetch_add(&stack->wake_seq, 1);
+	__sheaf_wake(&stack->wake_seq, n > UINT32_MAX ? UINT32_MAX : (uint32_t)n);
+}
+
+struct percpu_dir *percpu_init(size_t ncpus, size_t objsize, pa_t *pa);
+void percpu_release(struct percpu_dir *dir);
+sheaf_node_t *percpu_alloc_node(percpu_t *percpu);
+void percpu_free_any_node(percpu_t *pc, sheaf_node_t *node);
+size_t percpu_free_chain(percpu_t *pc, sheaf_node_t *chain);
 void percpu_free_remote_node(percpu_t *src, percpu_t *dst, sheaf_node_t *node);
+void percpu_free_remote_chain(percpu_t *src, percpu_t *dst,
+							  sheaf_node_t *first);
+void percpu_flush_remote(percpu_t *src);
+void percpu_synchronize(struct percpu_dir *dir);
+void percpu_retire_node(percpu_t *pc, sheaf_node_t *node);
+sheaf_node_t *percpu_shrink(percpu_t *percpu, size_t keep);
+size_t percpu_free_pages(struct percpu_dir *dir, sheaf_node_t *pages);
+void percpu_stats_read(struct percpu_dir *dir, struct sheaf_stats *stats);
 
 int sheaf_init(sheaf_t *stack, size_t ncpus, pa_t *pa);
 void sheaf_release(sheaf_t *stack);
 int sheaf_push(sheaf_t *stack, uintptr_t val, size_t ncpu);
 int sheaf_pop(sheaf_t *stack, uintptr_t *val, size_t ncpu);
+int sheaf_pop_wait(sheaf_t *stack, uintptr_t *val, size_t ncpu,
+				   uint64_t timeout_ns);
+int sheaf_push_cpu(sheaf_t *stack, uintptr_t val);
+int sheaf_pop_cpu(sheaf_t *stack, uintptr_t *val);
+int sheaf_push_bulk(sheaf_t *stack, const uintptr_t *vals, size_t n,
+					size_t ncpu);
+int sheaf_pop_bulk(sheaf_t *stack, uintptr_t *vals, size_t max, size_t ncpu);
+int sheaf_pop_all(sheaf_t *stack, void (*fn)(uintptr_t, void *), void *opaque,
+				  size_t ncpu);
+int sheaf_shrink(sheaf_t *stack, size_t ncpu, size_t keep);
+int sheaf_stats_read(sheaf_t *stack, struct sheaf_stats *stats);
 
 #endif
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_INLINE_H
+#define __SHEAF_INLINE_H
+
+#include "sheaf.h"
+
+/*
+ * Inline fast paths of sheaf_push() and sheaf_pop(), which compile into the
+ * caller rather than a call into the library. They take a node from the
+ * caller's freelist and try the CAS on the head once. Everything else, i.e.
+ * an empty freelist, a contended head or a node owned by another CPU, goes
+ * through the library.
+ *
+ * They reach into the structures of the library, so it must be built with the
+ * same PAGE_SIZE and SHEAF_* options as the code including this file.
+ *
+ * Define SHEAF_NCPUS to the number of CPUs the stacks were created with to
+ * drop the checks on the arguments. The caller then guarantees that ncpu is
+ * below SHEAF_NCPUS, which is only asserted with DEBUG, and the compiler gets
+ * to fold the lookup of the per-CPU structure.
+ */
+
+#ifdef SHEAF_NCPUS
+
+_Static_assert(SHEAF_NCPUS > 0 && SHEAF_NCPUS <= SHEAF_MAX_CPUS,
+			   "SHEAF_NCPUS out of range");
+
+static inline int __sheaf_inline_valid(sheaf_t *stack, size_t ncpu)
+{
+	DBG_ASSERT(stack && stack->ncpus == SHEAF_NCPUS && ncpu < SHEAF_NCPUS);
+	(void)stack;
+	if (ncpu >= SHEAF_NCPUS)
+		__builtin_unreachable();
+	return 1;
+}
+
+#else
+
+static inline int __sheaf_inline_valid(sheaf_t *stack, size_t ncpu)
+{
+	return stack && ncpu < stack->ncpus;
+}
+
+#endif
+
+static inline int sheaf_push_inline(sheaf_t *stack, uintptr_t val,
+									size_t ncpu)
+{
+	struct percpu_dir *dir;
+	sheaf_head_t head;
+	sheaf_node_t *node;
+	percpu_t *pc;
+
+	if (!__sheaf_inline_valid(stack, ncpu))
+		return -SHEAF_EINVAL;
+
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	node = percpu_take_node(pc);
+	if (!node)
+		return sheaf_push(stack, val, ncpu);
+
+	node->val = val;
+
+	head = sheaf_head_load(&stack->head);
+	if (!sheaf_head_try_push(dir, &stack->head, &head, node, node)) {
+		/* Let the library retry, with elimination and backoff */
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_free_node(pc, node);
+		return sheaf_push(stack, val, ncpu);
+	}
+	percpu_stat_add(pc, push, 1);
+	sheaf_wake(stack, 1);
+
+	return 0;
+}
+
+static inline int sheaf_pop_inline(sheaf_t *stack, uintptr_t *ret,
+								   size_t ncpu)
+{
+	struct percpu_dir *dir;
+	sheaf_head_t head;
+	sheaf_node_t *node;
+	percpu_t *pc;
+	size_t n;
+
+	if (!__sheaf_inline_valid(stack, ncpu))
+		return -SHEAF_EINVAL;
+
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	percpu_read_lock(pc);
+
+	head = sheaf_head_load(&stack->head);
+	if (!head.top) {
+		percpu_read_unlock(pc);
+		percpu_stat_add(pc, pop_empty, 1);
+		return -SHEAF_EAGAIN;
+	}
+
+	node = sheaf_head_try_pop(dir, &stack->head, &head, 1, &n);
+	percpu_read_unlock(pc);
+	if (!node) {
+		percpu_stat_add(pc, pop_retry, 1);
+		return sheaf_pop(stack, ret, ncpu);
+	}
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = node->val;
+
+	if (sheaf_node_owner(node) == ncpu)
+		percpu_free_node(pc, node);
+	else
+		percpu_free_any_node(pc, node);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_SPMC_H
+#define __SHEAF_SPMC_H
+
+#include "sheaf.h"
+
+/*
+ * A stack with a single producer and any number of consumers. Popped nodes are
+ * retired rather than freed, so a node cannot be pushed again while a pop
+ * still looks at it. This keeps the head free of ABA problems without a
+ * counter: it is a plain pointer updated with a single-word CAS.
+ */
+struct sheaf_spmc {
+	/* First node of the stack */
+	_Atomic(sheaf_node_t *) top __attribute__((aligned(64)));
+	/* Per-CPU directory */
+	struct percpu_dir *percpu __attribute__((aligned(64)));
+	/* Number of items in the percpu array */
+	size_t ncpus;
+	/* Page allocator provided by the user */
+	pa_t *pa;
+};
+
+typedef struct sheaf_spmc sheaf_spmc_t;
+
+int sheaf_spmc_init(sheaf_spmc_t *stack, size_t ncpus, pa_t *pa);
+void sheaf_spmc_release(sheaf_spmc_t *stack);
+/* Only ever called by the producer */
+int sheaf_spmc_push(sheaf_spmc_t *stack, uintptr_t val, size_t ncpu);
+int sheaf_spmc_pop(sheaf_spmc_t *stack, uintptr_t *val, size_t ncpu);
+
+#endif
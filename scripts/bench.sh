@@ -8,7 +8,7 @@ hyperfine --shell none \
 	--warmup 5 \
 	--parameter-list cc clang \
 	--parameter-list page_size 0x1000UL,0x200000UL \
-	--parameter-list yield 0,1 \
+	--parameter-list yield 0,1,2 \
 	--parameter-list impl sheaf \
 	--parameter-list threads 1,2,4,8,16 \
 	--prepare "$build {impl} {threads} {yield} clang {page_size}" \
@@ -0,0 +1,22 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Compare the double-width heads against the single-word index heads of
+# SHEAF_INDEX_HEAD with the native benchmark. Extra arguments are passed to
+# bench/bench. The output can be plotted with plot.py
+
+base=$(git rev-parse --show-toplevel)
+bench="$base/bench/bench"
+out=head.csv
+
+header=-H
+rm -f "$out"
+for cflags in "" "-DSHEAF_INDEX_HEAD"; do
+	make -C "$base" clean > /dev/null
+	make -C "$base" CFLAGS="$cflags" bench -j"$(nproc)" || exit 1
+
+	for threads in 1 2 4 8 16; do
+		"$bench" $header -t "$threads" -p -R 5 "$@" >> "$out" || exit 1
+		header=
+	done
+done
@@ -0,0 +1,21 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Sweep the native benchmark over implementations and thread counts. Extra
+# arguments are passed to bench/bench, e.g. "-s" for producers/consumers. The
+# output can be plotted with plot.py
+
+base=$(git rev-parse --show-toplevel)
+bench="$base/bench/bench"
+out=native.csv
+
+make -C "$base" bench -j"$(nproc)" || exit 1
+
+header=-H
+rm -f "$out"
+for impl in sheaf sheaf-cpu sheaf-inline sheaf-multi spin mutex; do
+	for threads in 2 4 8 16; do
+		"$bench" $header -i "$impl" -t "$threads" -p -R 5 "$@" >> "$out" || exit 1
+		header=
+	done
+done
@@ -30,11 +30,13 @@ case "$impl" in
 			*) echo "$0: invalid yield: '${yield}'"; exit 1 ;;
 		esac
 		;;
-	"sheaf")
+	"sheaf"|"sheaf-index")
 		target=tests/test_stack_total_elems
+		[ "$impl" = "sheaf-index" ] && cflags="${cflags} -DSHEAF_INDEX_HEAD"
 		case "$yield" in
 			"0") cflags="${cflags} -D__SHEAF_RELAX_ARCH" ;;
 			"1") cflags="${cflags} -D__SHEAF_RELAX_OS" ;;
+			"2") cflags="${cflags} -D__SHEAF_RELAX_BACKOFF" ;;
 			*) echo "$0: invalid yield: '${yield}'"; exit 1 ;;
 
 		esac
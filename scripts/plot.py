@@ -14,7 +14,8 @@ if __name__ == "__main__":
 			experiment = experiment.rstrip().split(',')
 			vals = {key: data for key, data in zip(keys, experiment)}
 
-			relax = "yield" if vals["parameter_yield"] == "1" else "pause"
+			relax = {"1": "yield", "2": "backoff"}.get(
+				vals["parameter_yield"], "pause")
 			cc = vals.get('parameter_cc', None)
 			page_size = vals.get('parameter_page_size', None)
 
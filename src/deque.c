@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "deque.h"
+#include "pa.h"
+
+static inline struct sheaf_deque_cpu *deque_get(sheaf_deque_t *deque,
+												size_t ncpu)
+{
+	return &deque->pages[ncpu / SHEAF_DEQUE_PER_PAGE]
+						[ncpu % SHEAF_DEQUE_PER_PAGE];
+}
+
+static inline _Atomic uintptr_t *deque_slot(struct sheaf_deque_buf *buf,
+											int64_t i)
+{
+	size_t slot = (size_t)i & buf->mask;
+
+	return &buf->pages[slot / SHEAF_DEQUE_SLOTS_PER_PAGE]
+					  [slot % SHEAF_DEQUE_SLOTS_PER_PAGE];
+}
+
+static inline size_t deque_buf_pages(struct sheaf_deque_buf *buf)
+{
+	return (buf->mask + 1) / SHEAF_DEQUE_SLOTS_PER_PAGE;
+}
+
+static void deque_buf_free(pa_t *pa, struct sheaf_deque_buf *buf)
+{
+	size_t i;
+
+	for (i = 0; i < deque_buf_pages(buf); ++i)
+		pa_free(pa, buf->pages[i]);
+	pa_free(pa, buf);
+}
+
+/*
+ * Allocate a buffer twice as large as old, or of a single page if old is NULL,
+ * holding the values of old between top and bottom.
+ */
+static struct sheaf_deque_buf *deque_buf_grow(pa_t *pa,
+											  struct sheaf_deque_buf *old,
+											  int64_t top, int64_t bottom)
+{
+	size_t i, npages = old ? 2 * deque_buf_pages(old) : 1;
+	struct sheaf_deque_buf *buf;
+
+	if (npages > SHEAF_DEQUE_MAX_PAGES)
+		return NULL;
+
+	buf = (struct sheaf_deque_buf *)pa_alloc(pa);
+	if (!buf)
+		return NULL;
+
+	buf->mask = npages * SHEAF_DEQUE_SLOTS_PER_PAGE - 1;
+	buf->prev = old;
+	for (i = 0; i < npages; ++i) {
+		buf->pages[i] = (_Atomic uintptr_t *)pa_alloc(pa);
+		if (!buf->pages[i]) {
+			while (i--)
+				pa_free(pa, buf->pages[i]);
+			pa_free(pa, buf);
+			return NULL;
+		}
+	}
+
+	for (; top < bottom; ++top)
+		atomic_store_explicit(deque_slot(buf, top),
+							  atomic_load_explicit(deque_slot(old, top),
+												   memory_order_relaxed),
+							  memory_order_relaxed);
+
+	return buf;
+}
+
+int sheaf_deque_init(sheaf_deque_t *deque, size_t ncpus, pa_t *pa)
+{
+	struct sheaf_deque_cpu *dc;
+	size_t i, npages;
+
+	if (!deque || !ncpus)
+		return -SHEAF_EINVAL;
+	if (ncpus > SHEAF_DEQUE_MAX_CPUS)
+		return -SHEAF_ENOMEM;
+
+	deque->pa = pa;
+	deque->ncpus = ncpus;
+
+	deque->pages = (struct sheaf_deque_cpu **)pa_alloc(pa);
+	if (!deque->pages)
+		return -SHEAF_ENOMEM;
+	__builtin_memset(deque->pages, 0, PAGE_SIZE);
+
+	npages = (ncpus + SHEAF_DEQUE_PER_PAGE - 1) / SHEAF_DEQUE_PER_PAGE;
+	for (i = 0; i < npages; ++i) {
+		deque->pages[i] = (struct sheaf_deque_cpu *)pa_alloc(pa);
+		if (!deque->pages[i]) {
+			deque->ncpus = 0;
+			sheaf_deque_release(deque);
+			return -SHEAF_ENOMEM;
+		}
+	}
+
+	for (i = 0; i < ncpus; ++i) {
+		dc = deque_get(deque, i);
+		atomic_init(&dc->top, 0);
+		atomic_init(&dc->bottom, 0);
+		atomic_init(&dc->buf, NULL);
+	}
+
+	return 0;
+}
+
+void sheaf_deque_release(sheaf_deque_t *deque)
+{
+	struct sheaf_deque_buf *buf, *prev;
+	size_t i;
+
+	if (!deque)
+		return;
+
+	for (i = 0; i < deque->ncpus; ++i) {
+		for (buf = atomic_load(&deque_get(deque, i)->buf); buf; buf = prev) {
+			prev = buf->prev;
+			deque_buf_free(deque->pa, buf);
+		}
+	}
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*deque->pages) && deque->pages[i];
+		 ++i)
+		pa_free(deque->pa, deque->pages[i]);
+	pa_free(deque->pa, deque->pages);
+}
+
+int sheaf_deque_push(sheaf_deque_t *deque, uintptr_t val, size_t ncpu)
+{
+	struct sheaf_deque_cpu *dc;
+	struct sheaf_deque_buf *buf;
+	int64_t top, bottom;
+
+	if (!deque || ncpu >= deque->ncpus)
+		return -SHEAF_EINVAL;
+
+	dc = deque_get(deque, ncpu);
+	bottom = atomic_load_explicit(&dc->bottom, memory_order_relaxed);
+	top = atomic_load_explicit(&dc->top, memory_order_acquire);
+	buf = atomic_load_explicit(&dc->buf, memory_order_relaxed);
+
+	if (!buf || (size_t)(bottom - top) > buf->mask) {
+		buf = deque_buf_grow(deque->pa, buf, top, bottom);
+		if (!buf)
+			return -SHEAF_ENOMEM;
+		atomic_store_explicit(&dc->buf, buf, memory_order_release);
+	}
+
+	atomic_store_explicit(deque_slot(buf, bottom), val, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dc->bottom, bottom + 1, memory_order_relaxed);
+
+	return 0;
+}
+
+int sheaf_deque_pop(sheaf_deque_t *deque, uintptr_t *ret, size_t ncpu)
+{
+	struct sheaf_deque_cpu *dc;
+	struct sheaf_deque_buf *buf;
+	int64_t top, bottom;
+	uintptr_t val;
+	int err = 0;
+
+	if (!deque || ncpu >= deque->ncpus)
+		return -SHEAF_EINVAL;
+
+	/* Claim the bottom value before looking at the top, so that thieves
+	 * either see it gone or we see them take it */
+	dc = deque_get(deque, ncpu);
+	bottom = atomic_load_explicit(&dc->bottom, memory_order_relaxed) - 1;
+	buf = atomic_load_explicit(&dc->buf, memory_order_relaxed);
+	atomic_store_explicit(&dc->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&dc->top, memory_order_relaxed);
+
+	if (top > bottom) {
+		atomic_store_explicit(&dc->bottom, bottom + 1, memory_order_relaxed);
+		return -SHEAF_EAGAIN;
+	}
+
+	val = atomic_load_explicit(deque_slot(buf, bottom), memory_order_relaxed);
+	if (top == bottom) {
+		/* This is the last value, which a thief might be taking too */
+		if (!atomic_compare_exchange_strong_explicit(&dc->top, &top, top + 1,
+													 memory_order_seq_cst,
+													 memory_order_relaxed))
+			err = -SHEAF_EAGAIN;
+		atomic_store_explicit(&dc->bottom, bottom + 1, memory_order_relaxed);
+	}
+
+	if (!err && ret)
+		*ret = val;
+
+	return err;
+}
+
+/* Steal the oldest value of dc. Returns 1 if a value was stolen, 0 if dc is
+ * empty, and -1 if another CPU took the value first */
+static int deque_steal_one(struct sheaf_deque_cpu *dc, uintptr_t *ret)
+{
+	struct sheaf_deque_buf *buf;
+	int64_t top, bottom;
+	uintptr_t val;
+
+	top = atomic_load_explicit(&dc->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	bottom = atomic_load_explicit(&dc->bottom, memory_order_acquire);
+	if (top >= bottom)
+		return 0;
+
+	buf = atomic_load_explicit(&dc->buf, memory_order_acquire);
+	val = atomic_load_explicit(deque_slot(buf, top), memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&dc->top, &top, top + 1,
+												 memory_order_seq_cst,
+												 memory_order_relaxed))
+		return -1;
+
+	if (ret)
+		*ret = val;
+	return 1;
+}
+
+int sheaf_deque_steal(sheaf_deque_t *deque, uintptr_t *ret, size_t ncpu)
+{
+	size_t i, victim;
+	int stolen;
+
+	if (!deque || ncpu >= deque->ncpus)
+		return -SHEAF_EINVAL;
+
+	/* Go over the other CPUs, starting from the next one so that thieves
+	 * spread out. Losing a race means someone else made progress, so try
+	 * the same victim again */
+	for (i = 1; i < deque->ncpus; ++i) {
+		victim = (ncpu + i) % deque->ncpus;
+		do {
+			stolen = deque_steal_one(deque_get(deque, victim), ret);
+		} while (stolen < 0);
+		if (stolen)
+			return 0;
+	}
+
+	return -SHEAF_EAGAIN;
+}
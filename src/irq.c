@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#define _GNU_SOURCE
+#include "irq.h"
+
+#ifndef __SHEAF_IRQ_EXTERN
+
+#ifdef __unix__
+
+#include <pthread.h>
+#include <signal.h>
+
+void __sheaf_irq_save(__sheaf_irq_flags_t *flags)
+{
+	sigset_t all;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, flags);
+}
+
+void __sheaf_irq_restore(const __sheaf_irq_flags_t *flags)
+{
+	pthread_sigmask(SIG_SETMASK, flags, NULL);
+}
+
+#elif defined(SHEAF_IRQSAFE)
+
+/* Hooks that do nothing would silently leave handlers free to corrupt the
+ * paths they are meant to protect */
+#error "SHEAF_IRQSAFE needs __SHEAF_IRQ_EXTERN on this target"
+
+#endif
+
+#endif
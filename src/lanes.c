@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stddef.h>
+
+#include "lanes.h"
+#include "pa.h"
+
+int sheaf_lanes_init(struct sheaf_lane **lanes, struct percpu_dir **dir,
+					 size_t nlanes, size_t ncpus, pa_t *pa)
+{
+	size_t i;
+
+	*lanes = (struct sheaf_lane *)pa_alloc(pa);
+	if (!*lanes)
+		return -SHEAF_ENOMEM;
+	for (i = 0; i < nlanes; ++i)
+		sheaf_head_init(&(*lanes)[i].head, (sheaf_head_t){ 0 });
+
+	*dir = percpu_init(ncpus, sizeof(sheaf_node_t), pa);
+	if (!*dir) {
+		pa_free(pa, *lanes);
+		return -SHEAF_ENOMEM;
+	}
+
+	return 0;
+}
+
+void sheaf_lanes_release(struct sheaf_lane *lanes, struct percpu_dir *dir,
+						 size_t nlanes, pa_t *pa)
+{
+	percpu_t *pc;
+	sheaf_head_t head;
+	size_t i;
+
+	/* Nobody else uses the lanes anymore, so each can be taken as is */
+	pc = percpu_get(dir, 0);
+	for (i = 0; i < nlanes; ++i) {
+		head = sheaf_head_load(&lanes[i].head);
+		percpu_free_chain(pc, sheaf_ref_node(dir, head.top));
+	}
+
+	percpu_release(dir);
+	pa_free(pa, lanes);
+}
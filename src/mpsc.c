@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "mpsc.h"
+
+int sheaf_mpsc_init(sheaf_mpsc_t *stack, size_t ncpus, pa_t *pa)
+{
+	if (!stack || !ncpus)
+		return -SHEAF_EINVAL;
+
+	stack->pa = pa;
+	stack->ncpus = ncpus;
+	atomic_init(&stack->top, NULL);
+
+	stack->percpu = percpu_init(ncpus, sizeof(sheaf_node_t), pa);
+	if (!stack->percpu)
+		return -SHEAF_ENOMEM;
+
+	return 0;
+}
+
+void sheaf_mpsc_release(sheaf_mpsc_t *stack)
+{
+	if (!stack)
+		return;
+
+	sheaf_mpsc_pop_all(stack, NULL, NULL, 0);
+	percpu_release(stack->percpu);
+}
+
+int sheaf_mpsc_push(sheaf_mpsc_t *stack, uintptr_t val, size_t ncpu)
+{
+	sheaf_node_t *node, *top;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	node = percpu_alloc_node(pc);
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	node->val = val;
+
+	top = atomic_load_explicit(&stack->top, memory_order_relaxed);
+	while (1) {
+		sheaf_node_set_next(node, top);
+		if (atomic_compare_exchange_weak_explicit(&stack->top, &top, node,
+												  memory_order_release,
+												  memory_order_relaxed))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, 1);
+
+	return 0;
+}
+
+int sheaf_mpsc_pop(sheaf_mpsc_t *stack, uintptr_t *ret, size_t ncpu)
+{
+	sheaf_node_t *node;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+
+	/* Pushes may still change the head under our feet, but the top node
+	 * stays in the stack, with the same next, until we pop it */
+	node = atomic_load_explicit(&stack->top, memory_order_acquire);
+	while (1) {
+		if (!node) {
+			percpu_stat_add(pc, pop_empty, 1);
+			return -SHEAF_EAGAIN;
+		}
+		if (atomic_compare_exchange_weak_explicit(&stack->top, &node,
+												  sheaf_node_next(node),
+												  memory_order_acquire,
+												  memory_order_acquire))
+			break;
+		percpu_stat_add(pc, pop_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = node->val;
+
+	percpu_free_any_node(pc, node);
+
+	return 0;
+}
+
+int sheaf_mpsc_pop_all(sheaf_mpsc_t *stack, void (*fn)(uintptr_t, void *),
+					   void *opaque, size_t ncpu)
+{
+	sheaf_node_t *first, *node;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+
+	first = atomic_exchange_explicit(&stack->top, NULL, memory_order_acquire);
+	if (!first) {
+		percpu_stat_add(pc, pop_empty, 1);
+		return -SHEAF_EAGAIN;
+	}
+
+	/* Hand out the values in stack order before giving back the nodes */
+	if (fn) {
+		for (node = first; node; node = sheaf_node_next(node))
+			fn(node->val, opaque);
+	}
+
+	percpu_stat_add(pc, pop, percpu_free_chain(pc, first));
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "multi.h"
+
+/* Lane of a CPU. Pushes go there, and pops start from there */
+static inline size_t multi_lane(sheaf_multi_t *stack, size_t ncpu)
+{
+	return ncpu % stack->nlanes;
+}
+
+int sheaf_multi_init(sheaf_multi_t *stack, size_t nlanes, size_t ncpus,
+					 pa_t *pa)
+{
+	if (!stack || !nlanes || nlanes > SHEAF_MULTI_MAX_LANES || !ncpus)
+		return -SHEAF_EINVAL;
+
+	stack->pa = pa;
+	stack->ncpus = ncpus;
+	stack->nlanes = nlanes;
+
+	return sheaf_lanes_init(&stack->lanes, &stack->percpu, nlanes, ncpus, pa);
+}
+
+void sheaf_multi_release(sheaf_multi_t *stack)
+{
+	if (!stack)
+		return;
+
+	sheaf_lanes_release(stack->lanes, stack->percpu, stack->nlanes,
+						stack->pa);
+}
+
+int sheaf_multi_push(sheaf_multi_t *stack, uintptr_t val, size_t ncpu)
+{
+	struct sheaf_lane *lane;
+	sheaf_head_t head;
+	sheaf_node_t *node;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	node = percpu_alloc_node(pc);
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	node->val = val;
+
+	lane = &stack->lanes[multi_lane(stack, ncpu)];
+	head = sheaf_head_load(&lane->head);
+	while (1) {
+		if (sheaf_head_try_push(stack->percpu, &lane->head, &head, node,
+								node))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, 1);
+
+	return 0;
+}
+
+int sheaf_multi_pop(sheaf_multi_t *stack, uintptr_t *ret, size_t ncpu)
+{
+	struct sheaf_lane *lane;
+	sheaf_node_t *node = NULL;
+	sheaf_head_t head;
+	percpu_t *pc;
+	size_t i, n;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	percpu_read_lock(pc);
+
+	/* Start from our own lane, and steal from the others once it is
+	 * empty */
+	for (i = 0; i < stack->nlanes && !node; ++i) {
+		lane = &stack->lanes[multi_lane(stack, ncpu + i)];
+		head = sheaf_head_load(&lane->head);
+		while (head.top) {
+			node = sheaf_head_try_pop(stack->percpu, &lane->head, &head, 1,
+									  &n);
+			if (node)
+				break;
+			percpu_stat_add(pc, pop_retry, 1);
+			percpu_relax(pc);
+		}
+	}
+
+	percpu_read_unlock(pc);
+
+	if (!node) {
+		percpu_stat_add(pc, pop_empty, 1);
+		return -SHEAF_EAGAIN;
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = node->val;
+
+	percpu_free_any_node(pc, node);
+
+	return 0;
+}
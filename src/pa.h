@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __SHEAF_PA_H
+#define __SHEAF_PA_H
+
+#include <stdint.h>
+
+#include "sheaf.h"
+
+/*
+ * Calls to the page allocator provided by the user, for the library only. The
+ * allocator or either of its functions may be missing, in which case there
+ * are no pages to allocate, and nothing to free.
+ */
+
+static inline uintptr_t pa_alloc(pa_t *pa)
+{
+	void *ptr = NULL;
+
+	if (pa && pa->alloc_page)
+		ptr = pa->alloc_page(pa->opaque);
+
+	return (uintptr_t)ptr;
+}
+
+static inline void pa_free(pa_t *pa, void *addr)
+{
+	if (pa && pa->free_page && addr)
+		pa->free_page(pa->opaque, addr);
+}
+
+#endif
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "park.h"
+
+#ifndef __SHEAF_PARK_EXTERN
+
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+#ifdef __linux__
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Stacks in shared memory may have sleepers in other processes */
+#ifdef SHEAF_SHARED
+#define SHEAF_FUTEX_WAIT FUTEX_WAIT
+#define SHEAF_FUTEX_WAKE FUTEX_WAKE
+#else
+#define SHEAF_FUTEX_WAIT FUTEX_WAIT_PRIVATE
+#define SHEAF_FUTEX_WAKE FUTEX_WAKE_PRIVATE
+#endif
+
+void __sheaf_park(_Atomic uint32_t *word, uint32_t val, uint64_t timeout_ns)
+{
+	struct timespec ts = {
+		.tv_sec = (time_t)(timeout_ns / NSEC_PER_SEC),
+		.tv_nsec = (long)(timeout_ns % NSEC_PER_SEC),
+	};
+
+	/* Fails right away if *word is no longer val */
+	syscall(SYS_futex, word, SHEAF_FUTEX_WAIT, val,
+			timeout_ns == UINT64_MAX ? NULL : &ts, NULL, 0);
+}
+
+void __sheaf_wake(_Atomic uint32_t *word, uint32_t n)
+{
+	syscall(SYS_futex, word, SHEAF_FUTEX_WAKE, n > INT_MAX ? INT_MAX : n,
+			NULL, NULL, 0);
+}
+
+uint64_t __sheaf_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+#else
+
+#include "os.h"
+
+void __sheaf_park(_Atomic uint32_t *word, uint32_t val, uint64_t timeout_ns)
+{
+	(void)word;
+	(void)val;
+	(void)timeout_ns;
+	__sheaf_os_relax();
+}
+
+void __sheaf_wake(_Atomic uint32_t *word, uint32_t n)
+{
+	(void)word;
+	(void)n;
+}
+
+uint64_t __sheaf_clock_ns(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+#endif
+
+#endif
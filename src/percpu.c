@@ -1,28 +1,77 @@
 // SPDX-License-Identifier: BSD-2-Clause
+#define _GNU_SOURCE
 #include <stdatomic.h>
 #include <stdint.h>
 
+#include "irq.h"
+#include "pa.h"
+#include "region.h"
 #include "sheaf.h"
 
-static inline uintptr_t pa_alloc(pa_t *pa)
+/* Keep interrupt handlers on this CPU out of paths that are not reentrant */
+#ifdef SHEAF_IRQSAFE
+#define percpu_irq_save(flags) __sheaf_irq_save(flags)
+#define percpu_irq_restore(flags) __sheaf_irq_restore(flags)
+#else
+#define percpu_irq_save(flags) ((void)(flags))
+#define percpu_irq_restore(flags) ((void)(flags))
+#endif
+
+/* Pages of a directory in a shared region come from the region itself, since
+ * the page allocator of the creator cannot be called from other processes */
+static inline uintptr_t dir_alloc_page(struct percpu_dir *dir)
+{
+#ifdef SHEAF_SHARED
+	void *region = sheaf_ptr_get(dir->region);
+
+	if (region)
+		return (uintptr_t)sheaf_region_alloc_page(region);
+#endif
+	return pa_alloc(dir->pa);
+}
+
+static inline void dir_free_page(struct percpu_dir *dir, void *addr)
 {
-	void *ptr = NULL;
+#ifdef SHEAF_SHARED
+	void *region = sheaf_ptr_get(dir->region);
+
+	if (region) {
+		if (addr)
+			sheaf_region_free_page(region, addr);
+		return;
+	}
+#endif
+	pa_free(dir->pa, addr);
+}
 
-	if (pa && pa->alloc_page)
-		ptr = pa->alloc_page(pa->opaque);
+static inline sheaf_ring_t *percpu_ring(percpu_t *pc)
+{
+	return sheaf_ptr_get(pc->ring);
+}
 
-	return (uintptr_t)ptr;
+/* Deferred ring entries are written by other CPUs, and read by the owner */
+static inline void ring_put(sheaf_ring_t *ent, sheaf_node_t *first)
+{
+#ifdef SHEAF_SHARED
+	atomic_store_explicit(ent, __sheaf_ptr_encode(ent, first),
+						  memory_order_release);
+#else
+	atomic_store_explicit(ent, first, memory_order_release);
+#endif
 }
 
-static inline void pa_free(pa_t *pa, void *addr)
+static inline sheaf_node_t *ring_take(sheaf_ring_t *ent)
 {
-	if (pa && pa->free_page && addr)
-		pa->free_page(pa->opaque, addr);
+#ifdef SHEAF_SHARED
+	return __sheaf_ptr_decode(ent, atomic_exchange(ent, 0));
+#else
+	return atomic_exchange(ent, NULL);
+#endif
 }
 
 static inline idx_t rbuf_bump(idx_t val)
 {
-	return (val + 1) % (PAGE_SIZE / sizeof(sheaf_node_t *));
+	return (val + 1) % (PAGE_SIZE / sizeof(sheaf_ring_t));
 }
 
 static inline int rbuf_full(idx_t push, idx_t pop)
@@ -37,9 +86,20 @@ static inline int rbuf_empty(idx_t push, idx_t pop)
 
 static void percpu_consume_deferred(percpu_t *pc)
 {
-	idx_t push, pop = atomic_load(&pc->pop);
-	sheaf_node_t *node;
+	sheaf_ring_t *ring = percpu_ring(pc);
+	sheaf_node_t *node, *next;
+	idx_t push, pop;
+
+#ifdef SHEAF_IRQSAFE
+	/* We interrupted this CPU in the middle of it. Leave the ring alone,
+	 * and let the caller look for nodes elsewhere */
+	if (atomic_load_explicit(&pc->consuming, memory_order_relaxed))
+		return;
+	atomic_store_explicit(&pc->consuming, 1, memory_order_relaxed);
+	atomic_signal_fence(memory_order_seq_cst);
+#endif
 
+	pop = atomic_load(&pc->pop);
 	while (1) {
 		push = atomic_load(&pc->push);
 		if (rbuf_empty(push, pop))
@@ -48,32 +108,94 @@ static void percpu_consume_deferred(percpu_t *pc)
 		/* Read the next entry. If it is NULL, the other end has reserved
 		 * the index but is in the process of writing to it, so wait  */
 		while (1) {
-			node = atomic_exchange(&pc->ring[pop], NULL);
+			node = ring_take(&ring[pop]);
 			if (node)
 				break;
+			percpu_stat_add(pc, ring_wait, 1);
 			__sheaf_relax();
 		}
 
-		/* Point to the next entry, and add the current entry to our
-		 * freelist */
+		/* Point to the next entry, and add the chain of nodes in the
+		 * current entry to our freelist */
 		pop = rbuf_bump(pop);
-		percpu_free_node(pc, node);
+		for (; node; node = next) {
+			next = sheaf_node_next(node);
+			percpu_free_node(pc, node);
+			percpu_stat_add(pc, deferred, 1);
+		}
 	}
 
 	/* Bump our index so that new entries can be pushed. */
 	atomic_store_explicit(&pc->pop, pop, memory_order_release);
+
+#ifdef SHEAF_IRQSAFE
+	atomic_signal_fence(memory_order_seq_cst);
+	atomic_store_explicit(&pc->consuming, 0, memory_order_relaxed);
+#endif
 }
 
-void percpu_free_remote_node(percpu_t *src, percpu_t *dst, sheaf_node_t *node)
+/* Put a NULL-terminated chain of free nodes in the depot, so that any CPU
+ * can take it */
+static void depot_push(percpu_t *pc, sheaf_node_t *first)
+{
+	struct percpu_dir *dir = percpu_dir_of(pc);
+	sheaf_head_t head, new;
+
+	head = sheaf_head_load(&dir->depot);
+	while (1) {
+		first->val = (uintptr_t)head.top;
+		new.top = sheaf_node_ref(first);
+		new.aba = head.aba + 1;
+		if (sheaf_head_cas(&dir->depot, &head, new))
+			break;
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+}
+
+/* Take a chain of free nodes from the depot, if any */
+static sheaf_node_t *depot_pop(percpu_t *pc)
+{
+	struct percpu_dir *dir = percpu_dir_of(pc);
+	sheaf_head_t head, new;
+
+	/* The top chain may be taken and its nodes reused under our feet,
+	 * same as with the top of the stack during a pop */
+	percpu_read_lock(pc);
+
+	head = sheaf_head_load(&dir->depot);
+	while (1) {
+		if (!head.top)
+			break;
+		new.top = (sheaf_ref_t)sheaf_ref_node(dir, head.top)->val;
+		new.aba = head.aba + 1;
+		if (sheaf_head_cas(&dir->depot, &head, new))
+			break;
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+
+	percpu_read_unlock(pc);
+	return sheaf_ref_node(dir, head.top);
+}
+
+/* Send a NULL-terminated chain of nodes owned by dst back to it, using a
+ * single entry of its ring buffer */
+void percpu_free_remote_chain(percpu_t *src, percpu_t *dst,
+							  sheaf_node_t *first)
 {
-	uint32_t pop, push = atomic_load(&dst->push);
+	sheaf_ring_t *ring = percpu_ring(dst);
+	idx_t pop, push = atomic_load(&dst->push);
 
 	while (1) {
 		pop = atomic_load(&dst->pop);
 
-		/* If the receiving end has no more room then take over the node */
+		/* If the receiving end has no more room, leave the nodes in the
+		 * depot. Whoever runs out of nodes first will take them from
+		 * there, instead of allocating a new page */
 		if (rbuf_full(push, pop)) {
-			percpu_free_node(src, node);
+			percpu_stat_add(src, ring_full, 1);
+			depot_push(src, first);
 			break;
 		}
 
@@ -83,96 +205,427 @@ void percpu_free_remote_node(percpu_t *src, percpu_t *dst, sheaf_node_t *node)
 		if (atomic_compare_exchange_weak_explicit(
 					&dst->push, &push, rbuf_bump(push), memory_order_acq_rel,
 					memory_order_acquire)) {
-			atomic_store_explicit(&dst->ring[push], node, memory_order_release);
+			ring_put(&ring[push], first);
+			percpu_relax_done(src);
 			break;
 		}
+		percpu_relax(src);
+	}
+}
+
+static void percpu_flush_stage(percpu_t *src, struct percpu_stage *st)
+{
+	sheaf_node_t *first = sheaf_ptr_get(st->first);
+
+	if (!first)
+		return;
+
+	percpu_free_remote_chain(src, sheaf_ptr_get(st->dst), first);
+	sheaf_ptr_set(st->first, NULL);
+	st->count = 0;
+}
+
+void percpu_flush_remote(percpu_t *src)
+{
+	struct percpu_stage *stage = sheaf_ptr_get(src->stage);
+	size_t i;
+
+	for (i = 0; i < PERCPU_STAGES; ++i)
+		percpu_flush_stage(src, &stage[i]);
+}
+
+void percpu_free_remote_node(percpu_t *src, percpu_t *dst, sheaf_node_t *node)
+{
+	struct percpu_stage *st = sheaf_ptr_get(src->stage);
+
+	st += dst->ncpu % PERCPU_STAGES;
+
+#ifdef SHEAF_IRQSAFE
+	/* We interrupted this CPU while it was staging a node. Send ours back
+	 * right away */
+	if (atomic_load_explicit(&src->staging, memory_order_relaxed)) {
+		sheaf_node_set_next(node, NULL);
+		percpu_stat_add(src, remote_free, 1);
+		percpu_free_remote_chain(src, dst, node);
+		return;
+	}
+	atomic_store_explicit(&src->staging, 1, memory_order_relaxed);
+	atomic_signal_fence(memory_order_seq_cst);
+#endif
+
+	/* Stage the node, so that it is sent back along with others for the
+	 * same CPU. Only stacks with more than PERCPU_STAGES CPUs share
+	 * stages, in which case a stage in use for another CPU sends that
+	 * batch first */
+	if (sheaf_ptr_get(st->dst) != dst) {
+		percpu_flush_stage(src, st);
+		sheaf_ptr_set(st->dst, dst);
+	}
+
+	sheaf_node_set_next(node, sheaf_ptr_get(st->first));
+	sheaf_ptr_set(st->first, node);
+	percpu_stat_add(src, remote_free, 1);
+
+	if (++st->count >= SHEAF_REMOTE_BATCH)
+		percpu_flush_stage(src, st);
+
+#ifdef SHEAF_IRQSAFE
+	atomic_signal_fence(memory_order_seq_cst);
+	atomic_store_explicit(&src->staging, 0, memory_order_relaxed);
+#endif
+}
+
+/* Free a node taken off a stack, whichever CPU owns it */
+void percpu_free_any_node(percpu_t *pc, sheaf_node_t *node)
+{
+	size_t owner = sheaf_node_owner(node);
+
+	/* If the node is in our percpu pool we can free it ourselves. If not,
+	 * we need to push it to that cpu's ringbuffer */
+	if (owner == pc->ncpu)
+		percpu_free_node(pc, node);
+	else
+		percpu_free_remote_node(pc, percpu_get(percpu_dir_of(pc), owner),
+								node);
+}
+
+/* Free a detached chain of nodes in a single pass. Nodes of other CPUs are
+ * grouped by owner in our stages, and sent back in batches as usual.
+ * Returns the number of nodes freed */
+size_t percpu_free_chain(percpu_t *pc, sheaf_node_t *chain)
+{
+	sheaf_node_t *node, *next;
+	size_t n = 0;
+
+	for (node = chain; node; node = next) {
+		next = sheaf_node_next(node);
+		percpu_free_any_node(pc, node);
+		n++;
+	}
+
+	return n;
+}
+
+#ifdef SHEAF_INDEX_HEAD
+
+/* Entry of a page number that was given back, linking to the next one */
+#define PGTBL_FREE(next) (((uintptr_t)(next) << 1) | 1)
+#define PGTBL_NONE UINT32_MAX
+
+static int pgtbl_init(struct percpu_dir *dir)
+{
+	_Atomic uintptr_t *top = (_Atomic uintptr_t *)dir_alloc_page(dir);
+
+	if (!top)
+		return 1;
+	__builtin_memset(top, 0, PAGE_SIZE);
+	sheaf_ptr_set(dir->pgtbl, top);
+
+	dir->pgtbl_next = 0;
+	dir->pgtbl_free = PGTBL_NONE;
+	atomic_flag_clear(&dir->pgtbl_lock);
+	return 0;
+}
+
+static void pgtbl_release(struct percpu_dir *dir)
+{
+	_Atomic uintptr_t *top = sheaf_ptr_get(dir->pgtbl);
+	size_t i;
+
+	if (!top)
+		return;
+
+	for (i = 0; i < SHEAF_PGTBL_ENTRIES; ++i)
+		dir_free_page(dir, (void *)sheaf_pgtbl_load(&top[i],
+													memory_order_relaxed));
+	dir_free_page(dir, top);
+}
+
+/* Interrupt handlers are kept out while the lock is held, since they could
+ * allocate a page and spin on it forever */
+static void pgtbl_lock(struct percpu_dir *dir, __sheaf_irq_flags_t *flags)
+{
+	percpu_irq_save(flags);
+	while (atomic_flag_test_and_set_explicit(&dir->pgtbl_lock,
+											 memory_order_acquire))
 		__sheaf_relax();
+}
+
+static void pgtbl_unlock(struct percpu_dir *dir, __sheaf_irq_flags_t *flags)
+{
+	atomic_flag_clear_explicit(&dir->pgtbl_lock, memory_order_release);
+	percpu_irq_restore(flags);
+}
+
+/* Give a number to a new node page, so that its nodes can be referred to by
+ * index. Only taken when pages come and go, never on the stack operations */
+static int pgtbl_add(struct percpu_dir *dir, struct sheaf_page *page)
+{
+	_Atomic uintptr_t *top = sheaf_ptr_get(dir->pgtbl), *leaf;
+	__sheaf_irq_flags_t flags;
+	uintptr_t next;
+	uint32_t pgno;
+
+	pgtbl_lock(dir, &flags);
+
+	if (dir->pgtbl_free != PGTBL_NONE) {
+		pgno = dir->pgtbl_free;
+		leaf = (_Atomic uintptr_t *)sheaf_pgtbl_load(
+				&top[pgno / SHEAF_PGTBL_ENTRIES], memory_order_relaxed);
+		next = sheaf_pgtbl_load(&leaf[pgno % SHEAF_PGTBL_ENTRIES],
+								memory_order_relaxed);
+		dir->pgtbl_free = (uint32_t)(next >> 1);
+	} else {
+		if (dir->pgtbl_next >= SHEAF_MAX_PAGES) {
+			pgtbl_unlock(dir, &flags);
+			return 1;
+		}
+
+		pgno = dir->pgtbl_next;
+		leaf = (_Atomic uintptr_t *)sheaf_pgtbl_load(
+				&top[pgno / SHEAF_PGTBL_ENTRIES], memory_order_relaxed);
+		if (!leaf) {
+			leaf = (_Atomic uintptr_t *)dir_alloc_page(dir);
+			if (!leaf) {
+				pgtbl_unlock(dir, &flags);
+				return 1;
+			}
+			__builtin_memset(leaf, 0, PAGE_SIZE);
+			sheaf_pgtbl_store(&top[pgno / SHEAF_PGTBL_ENTRIES],
+							  (uintptr_t)leaf, memory_order_release);
+		}
+		dir->pgtbl_next++;
 	}
+
+	sheaf_pgtbl_store(&leaf[pgno % SHEAF_PGTBL_ENTRIES], (uintptr_t)page,
+					  memory_order_relaxed);
+	page->pgno = pgno;
+
+	pgtbl_unlock(dir, &flags);
+	return 0;
 }
 
-void percpu_free_node(percpu_t *percpu, sheaf_node_t *node)
+static void pgtbl_del(struct percpu_dir *dir, struct sheaf_page *page)
 {
-	node->next_free = percpu->head;
-	percpu->head = node;
+	_Atomic uintptr_t *top = sheaf_ptr_get(dir->pgtbl), *leaf;
+	__sheaf_irq_flags_t flags;
+
+	pgtbl_lock(dir, &flags);
+
+	leaf = (_Atomic uintptr_t *)sheaf_pgtbl_load(
+			&top[page->pgno / SHEAF_PGTBL_ENTRIES], memory_order_relaxed);
+	sheaf_pgtbl_store(&leaf[page->pgno % SHEAF_PGTBL_ENTRIES],
+					  PGTBL_FREE(dir->pgtbl_free), memory_order_relaxed);
+	dir->pgtbl_free = page->pgno;
+
+	pgtbl_unlock(dir, &flags);
 }
 
-static sheaf_node_t *percpu_alloc_page(pa_t *pa)
+#else
+
+static inline int pgtbl_init(struct percpu_dir *dir)
+{
+	(void)dir;
+	return 0;
+}
+
+static inline void pgtbl_release(struct percpu_dir *dir)
 {
-	sheaf_node_t *page, *node;
-	size_t i, max = PAGE_SIZE / sizeof(*node);
+	(void)dir;
+}
 
-	page = (sheaf_node_t *)pa_alloc(pa);
+static inline int pgtbl_add(struct percpu_dir *dir, struct sheaf_page *page)
+{
+	(void)dir;
+	(void)page;
+	return 0;
+}
+
+static inline void pgtbl_del(struct percpu_dir *dir, struct sheaf_page *page)
+{
+	(void)dir;
+	(void)page;
+}
+
+#endif
+
+/* Carve a new node page into our freelist. Returns non-zero on failure */
+static int percpu_alloc_page(percpu_t *percpu)
+{
+	struct percpu_dir *dir = percpu_dir_of(percpu);
+	size_t i, objsize = dir->objsize;
+	uint32_t nobjs = dir->nobjs;
+	struct sheaf_page *page;
+	sheaf_node_t *nodes, *node, *next;
+
+	page = (struct sheaf_page *)dir_alloc_page(dir);
 	if (!page)
-		return NULL;
+		return 1;
+
+	if (pgtbl_add(dir, page)) {
+		dir_free_page(dir, page);
+		return 1;
+	}
+
+	page->ncpu = percpu->ncpu;
+	page->nfree = nobjs;
+	percpu_stat_add(percpu, page_alloc, 1);
+
+	/* The first node slot is taken by the header. Nodes may be larger
+	 * than sheaf_node_t when they hold objects */
+	nodes = (sheaf_node_t *)page + 1;
+	node = nodes;
+	for (i = 0; i < nobjs - 1; ++i) {
+		next = (sheaf_node_t *)((char *)node + objsize);
+		sheaf_node_set_next(node, next);
+		node = next;
+	}
+	percpu_push_free(percpu, nodes, node);
+	return 0;
+}
+
+/* Move a chain of nodes taken from the depot into our freelist */
+static void percpu_refill(percpu_t *percpu, sheaf_node_t *chain)
+{
+	sheaf_node_t *next;
 
-	for (i = 0; i < max - 1; ++i) {
-		node = &page[i];
-		node->next_free = node + 1;
+	for (; chain; chain = next) {
+		next = sheaf_node_next(chain);
+		percpu_free_node(percpu, chain);
 	}
-	page[max - 1].next_free = NULL;
-	return page;
 }
 
-sheaf_node_t *percpu_alloc_node(percpu_t *percpu, pa_t *pa)
+sheaf_node_t *percpu_alloc_node(percpu_t *percpu)
 {
 	sheaf_node_t *node;
 
-	if (!percpu->head)
+	/* Look for free nodes in our deferred ring first, then in the depot,
+	 * and only then in a new page */
+	if (!percpu_has_free(percpu))
 		percpu_consume_deferred(percpu);
 
-	node = percpu->head;
-	if (!node) {
-		node = percpu_alloc_page(pa);
-		if (!node)
+	if (!percpu_has_free(percpu))
+		percpu_refill(percpu, depot_pop(percpu));
+
+	/* An interrupt handler might take the nodes of the new page before
+	 * we do */
+	while (!(node = percpu_take_node(percpu))) {
+		if (percpu_alloc_page(percpu))
 			return NULL;
 	}
 
-	percpu->head = node->next_free;
 	return node;
 }
 
-static int percpu_init_single(percpu_t *pc, pa_t *pa)
+static int percpu_init_single(struct percpu_dir *dir, percpu_t *pc,
+							  size_t ncpu)
 {
-	pc->head = NULL;
+	struct percpu_stage *stage;
+	sheaf_ring_t *ring;
+
+#ifdef SHEAF_IRQSAFE
+	sheaf_head_init(&pc->head, (sheaf_head_t){ 0 });
+	atomic_init(&pc->read_nest, 0);
+	atomic_init(&pc->consuming, 0);
+	atomic_init(&pc->staging, 0);
+	atomic_init(&pc->retiring, 0);
+	ring_put(&pc->pending, NULL);
+#else
+	sheaf_ptr_set(pc->head, NULL);
+#endif
+	atomic_flag_clear(&pc->claimed);
+	pc->ncpu = ncpu;
+	sheaf_ptr_set(pc->dir, dir);
+	atomic_init(&pc->active, 0);
+	sheaf_ptr_set(pc->retired, NULL);
+	pc->nretired = 0;
+	sheaf_ptr_set(pc->limbo, NULL);
+	pc->limbo_epoch = 0;
+#ifdef SHEAF_STATS
+	__builtin_memset(&pc->stats, 0, sizeof(pc->stats));
+#endif
+#ifdef __SHEAF_RELAX_BACKOFF
+	__sheaf_backoff_init(&pc->backoff, ncpu + 1);
+#endif
 	atomic_init(&pc->push, 0);
 	atomic_init(&pc->pop, 0);
 
-	pc->ring = (sheaf_node_t * _Atomic *)pa_alloc(pa);
-	if (!pc->ring)
+	ring = (sheaf_ring_t *)dir_alloc_page(dir);
+	if (!ring)
 		return 1;
-	__builtin_memset(pc->ring, 0, PAGE_SIZE);
+	__builtin_memset(ring, 0, PAGE_SIZE);
+	sheaf_ptr_set(pc->ring, ring);
+
+	stage = (struct percpu_stage *)dir_alloc_page(dir);
+	if (!stage) {
+		dir_free_page(dir, ring);
+		return 1;
+	}
+	__builtin_memset(stage, 0, PAGE_SIZE);
+	sheaf_ptr_set(pc->stage, stage);
 
 	/* Pre-allocate the first node page */
-	pc->head = percpu_alloc_page(pa);
-	if (!pc->head) {
-		pa_free(pa, pc->ring);
+	if (percpu_alloc_page(pc)) {
+		dir_free_page(dir, stage);
+		dir_free_page(dir, ring);
 		return 1;
 	}
 
 	return 0;
 }
 
-percpu_t *percpu_init(size_t ncpus, pa_t *pa)
+struct percpu_dir *percpu_init(size_t ncpus, size_t objsize, pa_t *pa)
 {
-	percpu_t *percpus;
-	size_t i;
+	struct percpu_dir *dir;
+	size_t i, npages;
+	percpu_t *page;
+
+	if (ncpus > SHEAF_MAX_CPUS || objsize < sizeof(sheaf_node_t) ||
+		objsize > SHEAF_MAX_OBJ_SIZE || objsize % sizeof(sheaf_node_t))
+		return NULL;
 
-	/* We need to fit all percpu structures in a single page */
-	if (ncpus * sizeof(*percpus) > PAGE_SIZE)
+	dir = (struct percpu_dir *)pa_alloc(pa);
+	if (!dir)
 		return NULL;
+	__builtin_memset(dir, 0, PAGE_SIZE);
+
+	sheaf_head_init(&dir->depot, (sheaf_head_t){ 0 });
+	atomic_init(&dir->epoch, 0);
+	dir->pa = pa;
+#ifdef SHEAF_SHARED
+	if (pa->alloc_page == sheaf_region_alloc_page)
+		sheaf_ptr_set(dir->region, pa->opaque);
+#endif
+	dir->ncpus = 0;
+	dir->objsize = objsize;
+	dir->nobjs = (uint32_t)(SHEAF_MAX_OBJ_SIZE / objsize);
 
-	percpus = (percpu_t *)pa_alloc(pa);
-	if (!percpus)
+	if (pgtbl_init(dir)) {
+		dir_free_page(dir, dir);
 		return NULL;
+	}
 
+	npages = (ncpus + PERCPU_PER_PAGE - 1) / PERCPU_PER_PAGE;
+	for (i = 0; i < npages; ++i) {
+		page = (percpu_t *)dir_alloc_page(dir);
+		if (!page) {
+			percpu_release(dir);
+			return NULL;
+		}
+		sheaf_ptr_set(dir->pages[i], page);
+	}
+
+	/* Keep track of how many CPUs were initialized in case we need to
+	 * release them on failure */
 	for (i = 0; i < ncpus; ++i) {
-		if (percpu_init_single(&percpus[i], pa)) {
-			percpu_release(percpus, i, pa);
+		if (percpu_init_single(dir, percpu_get(dir, i), i)) {
+			percpu_release(dir);
 			return NULL;
 		}
+		dir->ncpus = i + 1;
 	}
 
-	return percpus;
+	return dir;
 }
 
 static inline uintptr_t align_to(uintptr_t addr, size_t align)
@@ -185,9 +638,265 @@ static inline uintptr_t page_align(uintptr_t addr)
 	return align_to(addr, PAGE_SIZE);
 }
 
-static inline int is_page_aligned(uintptr_t addr)
+/* Whether this is the first node in its page, i.e. the one right after
+ * the page header */
+static inline int is_first_node(sheaf_node_t *node)
+{
+	return (uintptr_t)node - page_align((uintptr_t)node) == sizeof(*node);
+}
+
+/* Whether a CPU is either not reading or has started reading in epoch cur or
+ * later */
+static inline int percpu_passed(percpu_t *pc, size_t cur)
+{
+	size_t active = atomic_load(&pc->active);
+
+	return !active || active > cur;
+}
+
+void percpu_synchronize(struct percpu_dir *dir)
+{
+	size_t i, cur;
+
+	/* Start a new epoch and wait until every CPU is either not reading
+	 * or has started reading in the new epoch. After that, nobody can
+	 * hold a reference to a node that was unreachable before this call */
+	cur = atomic_fetch_add(&dir->epoch, 2) + 2;
+	for (i = 0; i < dir->ncpus; ++i) {
+		while (!percpu_passed(percpu_get(dir, i), cur))
+			__sheaf_relax();
+	}
+}
+
+/* Retired nodes are linked through their value */
+static inline sheaf_node_t *retired_next(sheaf_node_t *node)
+{
+#ifdef SHEAF_SHARED
+	return __sheaf_ptr_decode(&node->val, (sheaf_off_t)node->val);
+#else
+	return (sheaf_node_t *)node->val;
+#endif
+}
+
+static inline void retired_link(sheaf_node_t *node, sheaf_node_t *next)
 {
-	return page_align(addr) == addr;
+#ifdef SHEAF_SHARED
+	node->val = (uintptr_t)__sheaf_ptr_encode(&node->val, next);
+#else
+	node->val = (uintptr_t)next;
+#endif
+}
+
+/* Free a list of retired nodes */
+static void percpu_free_retired(percpu_t *pc, sheaf_node_t *list)
+{
+	sheaf_node_t *chain = NULL, *node;
+
+	while (list) {
+		node = list;
+		list = retired_next(node);
+		sheaf_node_set_next(node, chain);
+		chain = node;
+	}
+	percpu_free_chain(pc, chain);
+}
+
+/*
+ * Free a node that was unlinked from a structure which others might still be
+ * reading it through, once they are done. Retired nodes are linked through
+ * their value rather than their next pointer, which readers may still follow
+ * and compare against.
+ *
+ * Rather than wait like percpu_synchronize() does, every SHEAF_RETIRE_BATCH
+ * nodes the current batch is sealed with a new epoch, and reused at a later
+ * batch once every CPU has moved past that epoch. Until then, retired nodes
+ * keep piling up. The caller must not hold the read lock.
+ */
+static void __percpu_retire_node(percpu_t *pc, sheaf_node_t *node)
+{
+	struct percpu_dir *dir = percpu_dir_of(pc);
+	sheaf_node_t *limbo;
+	size_t i;
+
+	retired_link(node, sheaf_ptr_get(pc->retired));
+	sheaf_ptr_set(pc->retired, node);
+	if (++pc->nretired % SHEAF_RETIRE_BATCH)
+		return;
+
+	limbo = sheaf_ptr_get(pc->limbo);
+	if (limbo) {
+		for (i = 0; i < dir->ncpus; ++i) {
+			if (!percpu_passed(percpu_get(dir, i), pc->limbo_epoch))
+				return;
+		}
+		percpu_free_retired(pc, limbo);
+	}
+
+	sheaf_ptr_set(pc->limbo, sheaf_ptr_get(pc->retired));
+	pc->limbo_epoch = atomic_fetch_add(&dir->epoch, 2) + 2;
+	sheaf_ptr_set(pc->retired, NULL);
+	pc->nretired = 0;
+}
+
+#ifdef SHEAF_IRQSAFE
+
+/* Leave a node retired by an interrupt handler for the retire it interrupted
+ * to take care of. Only that retire takes the list, all at once, so there is
+ * no ABA to worry about */
+static void retire_pending(percpu_t *pc, sheaf_node_t *node)
+{
+	sheaf_ring_t *ent = &pc->pending;
+#ifdef SHEAF_SHARED
+	sheaf_off_t old = atomic_load_explicit(ent, memory_order_relaxed);
+
+	do {
+		retired_link(node, __sheaf_ptr_decode(ent, old));
+	} while (!atomic_compare_exchange_weak_explicit(
+			ent, &old, __sheaf_ptr_encode(ent, node), memory_order_relaxed,
+			memory_order_relaxed));
+#else
+	sheaf_node_t *old = atomic_load_explicit(ent, memory_order_relaxed);
+
+	do {
+		retired_link(node, old);
+	} while (!atomic_compare_exchange_weak_explicit(
+			ent, &old, node, memory_order_relaxed, memory_order_relaxed));
+#endif
+}
+
+void percpu_retire_node(percpu_t *pc, sheaf_node_t *node)
+{
+	sheaf_node_t *next;
+
+	/* We interrupted this CPU while it was retiring a node */
+	if (atomic_load_explicit(&pc->retiring, memory_order_relaxed)) {
+		retire_pending(pc, node);
+		return;
+	}
+	atomic_store_explicit(&pc->retiring, 1, memory_order_relaxed);
+	atomic_signal_fence(memory_order_seq_cst);
+
+	/* Along with those left by handlers meanwhile. Any left after the last
+	 * look wait for the next retire on this CPU */
+	__percpu_retire_node(pc, node);
+	while ((node = ring_take(&pc->pending))) {
+		for (; node; node = next) {
+			next = retired_next(node);
+			__percpu_retire_node(pc, node);
+		}
+	}
+
+	atomic_signal_fence(memory_order_seq_cst);
+	atomic_store_explicit(&pc->retiring, 0, memory_order_relaxed);
+}
+
+#else
+
+void percpu_retire_node(percpu_t *pc, sheaf_node_t *node)
+{
+	__percpu_retire_node(pc, node);
+}
+
+#endif
+
+/* Marks a page being given back by percpu_shrink() */
+#define PAGE_DETACHED UINT32_MAX
+
+sheaf_node_t *percpu_shrink(percpu_t *percpu, size_t keep)
+{
+	sheaf_node_t *node, *next, *list, *last = NULL, *pages = NULL;
+	uint32_t nobjs = percpu_dir_of(percpu)->nobjs;
+	__sheaf_irq_flags_t flags;
+	struct sheaf_page *page;
+	size_t nr = 0;
+
+	/* Interrupt handlers would find the freelist empty in the meantime,
+	 * and allocate new pages */
+	percpu_irq_save(&flags);
+
+	percpu_consume_deferred(percpu);
+
+	list = percpu_detach_free(percpu);
+	for (node = list; node; node = sheaf_node_next(node))
+		nr++;
+
+	/*
+	 * A page can be given back once all of its nodes are in our freelist.
+	 * The decision is taken when we find the first of its nodes, and the
+	 * rest are unlinked as we find them. The first node of each detached
+	 * page is used to link them together.
+	 */
+	for (node = list; node; node = next) {
+		next = sheaf_node_next(node);
+		page = sheaf_node_page(node);
+		if (page->ncpu != percpu->ncpu) {
+			last = node;
+			continue;
+		}
+
+		if (page->nfree == nobjs && nr >= keep + nobjs) {
+			page->nfree = PAGE_DETACHED;
+			nr -= nobjs;
+		}
+
+		if (page->nfree != PAGE_DETACHED) {
+			last = node;
+			continue;
+		}
+
+		if (last)
+			sheaf_node_set_next(last, next);
+		else
+			list = next;
+		if (is_first_node(node)) {
+			sheaf_node_set_next(node, pages);
+			pages = node;
+		}
+	}
+
+	if (list)
+		percpu_push_free(percpu, list, last);
+
+	percpu_irq_restore(&flags);
+
+	return pages;
+}
+
+size_t percpu_free_pages(struct percpu_dir *dir, sheaf_node_t *pages)
+{
+	sheaf_node_t *node;
+	size_t n = 0;
+
+	while (pages) {
+		node = pages;
+		pages = sheaf_node_next(node);
+		pgtbl_del(dir, sheaf_node_page(node));
+		dir_free_page(dir, sheaf_node_page(node));
+		n++;
+	}
+
+	return n;
+}
+
+void percpu_stats_read(struct percpu_dir *dir, struct sheaf_stats *stats)
+{
+#ifdef SHEAF_STATS
+	struct sheaf_stats *cnt;
+	size_t i, j;
+#endif
+
+	__builtin_memset(stats, 0, sizeof(*stats));
+
+#ifdef SHEAF_STATS
+	for (i = 0; i < dir->ncpus; ++i) {
+		cnt = &percpu_get(dir, i)->stats;
+		for (j = 0; j < sizeof(*stats) / sizeof(uint64_t); ++j)
+			((uint64_t *)stats)[j] +=
+				__atomic_load_n(&((uint64_t *)cnt)[j], __ATOMIC_RELAXED);
+	}
+#else
+	(void)dir;
+#endif
 }
 
 #define POINTERS_PER_PAGE (PAGE_SIZE / sizeof(uintptr_t))
@@ -202,14 +911,11 @@ static int percpu_release_nodes(percpu_t *percpu, void **accounting,
 	if (num_pages >= POINTERS_PER_PAGE)
 		return -1;
 
-	while (percpu->head) {
-		node = percpu->head;
-		percpu->head = node->next_free;
-
-		if (!is_page_aligned((uintptr_t)node))
+	while ((node = percpu_take_node(percpu))) {
+		if (!is_first_node(node))
 			continue;
 
-		accounting[num_pages++] = (void *)node;
+		accounting[num_pages++] = (void *)sheaf_node_page(node);
 		if (num_pages >= POINTERS_PER_PAGE) {
 			ret = -1;
 			break;
@@ -220,14 +926,20 @@ static int percpu_release_nodes(percpu_t *percpu, void **accounting,
 	return ret;
 }
 
-void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa)
+void percpu_release(struct percpu_dir *dir)
 {
-	size_t i, j, pages_found = 0, acc_pages = 0;
+	size_t i, j, ncpus, pages_found = 0, acc_pages = 0;
+	sheaf_node_t *chain;
 	void **accounting;
+	percpu_t *pc;
 
-	if (!percpu)
+	if (!dir)
 		return;
 
+	ncpus = dir->ncpus;
+	if (!ncpus)
+		goto free_dir;
+
 	/*
 	 * Now begins a complicated cleanup process. The main issue is that
 	 * CPUs/threads can take over each other's nodes, so it is hard to
@@ -236,11 +948,11 @@ void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa)
 	 * The idea here is to reuse the deferred ring buffer page of the
 	 * CPU 0 to account for all the pages that need to be freed. Go over
 	 * each per-CPU structure, and for each one, traverse the free list
-	 * Whenever we find a page-aligned address, store it into the ring
-	 * buffer page (aka "accounting" page) page. Whenever we fill that
-	 * page with addresses, take the ring buffer page of the next CPU.
-	 * If we run out of accounting pages, simply bail, as there is
-	 * nothing we can do.
+	 * Whenever we find the first node of a page, store the address of
+	 * its page into the ring buffer page (aka "accounting" page) page.
+	 * Whenever we fill that page with addresses, take the ring buffer
+	 * page of the next CPU. If we run out of accounting pages, simply
+	 * bail, as there is nothing we can do.
 	 *
 	 * We cannot free any pages until we've traversed all per-CPU
 	 * freelists, as there are no guarantees in terms of what CPU will
@@ -253,20 +965,38 @@ void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa)
 	 * caller is precisely asking for its pages back because it ran out
 	 * of them.
 	 */
-	accounting = (void **)percpu[acc_pages++].ring;
+	accounting = (void **)percpu_ring(percpu_get(dir, acc_pages++));
+
+	/* Nobody reads anymore, so retired nodes can be freed right away */
+	for (i = 0; i < ncpus; ++i) {
+		pc = percpu_get(dir, i);
+		percpu_free_retired(pc, sheaf_ptr_get(pc->limbo));
+		percpu_free_retired(pc, sheaf_ptr_get(pc->retired));
+#ifdef SHEAF_IRQSAFE
+		percpu_free_retired(pc, ring_take(&pc->pending));
+#endif
+	}
 
 	for (i = 0; i < ncpus; ++i)
-		percpu_consume_deferred(&percpu[i]);
+		percpu_flush_remote(percpu_get(dir, i));
+
+	for (i = 0; i < ncpus; ++i)
+		percpu_consume_deferred(percpu_get(dir, i));
+
+	/* Nodes left in the depot can go to any freelist */
+	while ((chain = depot_pop(percpu_get(dir, 0))))
+		percpu_refill(percpu_get(dir, 0), chain);
 
 	for (i = 0; i < ncpus; ++i) {
-		while (percpu_release_nodes(&percpu[i], accounting, &pages_found)) {
+		while (percpu_release_nodes(percpu_get(dir, i), accounting,
+									&pages_found)) {
 			/* If we ran out of accounting pages just skip this
 			 * per-CPU. This will leak memory but it's all we can do */
 			if (acc_pages >= ncpus) {
 				DBG("WARN: leaking pages\n");
 				break;
 			}
-			accounting = (void **)percpu[acc_pages++].ring;
+			accounting = (void **)percpu_ring(percpu_get(dir, acc_pages++));
 			pages_found = 0;
 		}
 	}
@@ -274,9 +1004,11 @@ void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa)
 	/* Now we can free all the pages at once. Go over each per-CPU, and
 	 * if we used it's ring buffer page as an accounting page, free the
 	 * pages listed there first. Finally, free the accounting page
-	 * itself */
+	 * itself, along with the page of its stages */
 	for (i = 0; i < ncpus; ++i) {
-		accounting = (void **)percpu[i].ring;
+		pc = percpu_get(dir, i);
+		dir_free_page(dir, sheaf_ptr_get(pc->stage));
+		accounting = (void **)percpu_ring(pc);
 
 		if (i < acc_pages) {
 			size_t lim;
@@ -288,11 +1020,17 @@ void percpu_release(percpu_t *percpu, size_t ncpus, pa_t *pa)
 			else
 				lim = POINTERS_PER_PAGE;
 			for (j = 0; j < lim; ++j)
-				pa_free(pa, accounting[j]);
+				dir_free_page(dir, accounting[j]);
 		}
 
-		pa_free(pa, accounting);
+		dir_free_page(dir, accounting);
 	}
 
-	pa_free(pa, percpu);
+free_dir:
+	/* Finally, free the pages holding the per-CPU structures, the page
+	 * table and the directory itself */
+	for (i = 0; i < PERCPU_DIR_SLOTS && sheaf_ptr_get(dir->pages[i]); ++i)
+		dir_free_page(dir, sheaf_ptr_get(dir->pages[i]));
+	pgtbl_release(dir);
+	dir_free_page(dir, dir);
 }
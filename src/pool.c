@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <limits.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+int sheaf_pool_init(sheaf_pool_t *pool, size_t size, size_t ncpus, pa_t *pa)
+{
+	if (!pool || !size || size > SHEAF_POOL_MAX_SIZE || !ncpus)
+		return -SHEAF_EINVAL;
+
+	/* Objects hold a node while they are free */
+	pool->size = (size + sizeof(sheaf_node_t) - 1) &
+				 ~(sizeof(sheaf_node_t) - 1);
+	pool->pa = pa;
+	pool->ncpus = ncpus;
+
+	pool->percpu = percpu_init(ncpus, pool->size, pa);
+	if (!pool->percpu)
+		return -SHEAF_ENOMEM;
+
+	return 0;
+}
+
+void sheaf_pool_release(sheaf_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	percpu_release(pool->percpu);
+}
+
+int sheaf_pool_alloc(sheaf_pool_t *pool, void **obj, size_t ncpu)
+{
+	sheaf_node_t *node;
+
+	if (!pool || !obj || ncpu >= pool->ncpus)
+		return -SHEAF_EINVAL;
+
+	node = percpu_alloc_node(percpu_get(pool->percpu, ncpu));
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	*obj = node;
+
+	return 0;
+}
+
+int sheaf_pool_free(sheaf_pool_t *pool, void *obj, size_t ncpu)
+{
+	if (!pool || !obj || ncpu >= pool->ncpus)
+		return -SHEAF_EINVAL;
+
+	percpu_free_any_node(percpu_get(pool->percpu, ncpu), obj);
+
+	return 0;
+}
+
+int sheaf_pool_alloc_bulk(sheaf_pool_t *pool, void **objs, size_t n,
+						  size_t ncpu)
+{
+	sheaf_node_t *node;
+	percpu_t *pc;
+	size_t i;
+
+	if (!pool || (n && !objs) || ncpu >= pool->ncpus)
+		return -SHEAF_EINVAL;
+
+	if (n > INT_MAX)
+		n = INT_MAX;
+
+	pc = percpu_get(pool->percpu, ncpu);
+	for (i = 0; i < n; ++i) {
+		node = percpu_alloc_node(pc);
+		if (!node)
+			break;
+		objs[i] = node;
+	}
+
+	if (n && !i)
+		return -SHEAF_ENOMEM;
+
+	return (int)i;
+}
+
+int sheaf_pool_free_bulk(sheaf_pool_t *pool, void *const *objs, size_t n,
+						 size_t ncpu)
+{
+	sheaf_node_t *chain = NULL, *node;
+	size_t i;
+
+	if (!pool || (n && !objs) || ncpu >= pool->ncpus)
+		return -SHEAF_EINVAL;
+
+	/* Link them all so that each owner gets its objects back at once */
+	for (i = 0; i < n; ++i) {
+		if (!objs[i])
+			continue;
+		node = objs[i];
+		sheaf_node_set_next(node, chain);
+		chain = node;
+	}
+	percpu_free_chain(percpu_get(pool->percpu, ncpu), chain);
+
+	return 0;
+}
+
+int sheaf_pool_shrink(sheaf_pool_t *pool, size_t ncpu, size_t keep)
+{
+	sheaf_node_t *pages;
+
+	if (!pool || ncpu >= pool->ncpus)
+		return -SHEAF_EINVAL;
+
+	pages = percpu_shrink(percpu_get(pool->percpu, ncpu), keep);
+	if (!pages)
+		return 0;
+
+	/* Chains of free objects left in the depot are read by any CPU
+	 * taking them, which may still be looking at one of ours through a
+	 * stale top. Wait for all of them to finish before giving the pages
+	 * back */
+	percpu_synchronize(pool->percpu);
+
+	return (int)percpu_free_pages(pool->percpu, pages);
+}
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "prio.h"
+
+/* Highest level whose bit is set in a non-zero bitmap */
+static inline size_t prio_highest(uint64_t bits)
+{
+	return 63 - (size_t)__builtin_clzll(bits);
+}
+
+/*
+ * Clear the bit of a level a pop found empty. A push may have seen the bit
+ * still set in the meantime and left it alone, in which case its value is
+ * on the level by now, and the bit is set again. The CAS that pushed is
+ * ordered before the seq_cst load of the bitmap in sheaf_prio_push(), and a
+ * seq_cst fence orders the clear before the check of the level: either the
+ * push sees the bit cleared and sets it itself, or we see its value.
+ */
+static void prio_clear(sheaf_prio_t *stack, size_t level)
+{
+	uint64_t bit = 1ULL << level;
+
+	atomic_fetch_and(&stack->nonempty, ~bit);
+	/* The head may be loaded with acquire semantics only */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (sheaf_head_load(&stack->levels[level].head).top)
+		atomic_fetch_or(&stack->nonempty, bit);
+}
+
+int sheaf_prio_init(sheaf_prio_t *stack, size_t nlevels, size_t ncpus,
+					pa_t *pa)
+{
+	if (!stack || !nlevels || nlevels > SHEAF_PRIO_MAX_LEVELS || !ncpus)
+		return -SHEAF_EINVAL;
+
+	stack->pa = pa;
+	stack->ncpus = ncpus;
+	stack->nlevels = nlevels;
+	atomic_init(&stack->nonempty, 0);
+
+	return sheaf_lanes_init(&stack->levels, &stack->percpu, nlevels, ncpus,
+							pa);
+}
+
+void sheaf_prio_release(sheaf_prio_t *stack)
+{
+	if (!stack)
+		return;
+
+	sheaf_lanes_release(stack->levels, stack->percpu, stack->nlevels,
+						stack->pa);
+}
+
+int sheaf_prio_push(sheaf_prio_t *stack, uintptr_t val, size_t level,
+					size_t ncpu)
+{
+	struct sheaf_lane *lvl;
+	uint64_t bit = 1ULL << level;
+	sheaf_head_t head;
+	sheaf_node_t *node;
+	percpu_t *pc;
+
+	if (!stack || level >= stack->nlevels || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	node = percpu_alloc_node(pc);
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	node->val = val;
+
+	lvl = &stack->levels[level];
+	head = sheaf_head_load(&lvl->head);
+	while (1) {
+		if (sheaf_head_try_push(stack->percpu, &lvl->head, &head, node,
+								node))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, 1);
+
+	/* The bit is only written when the level was empty, so that busy
+	 * levels do not bounce the bitmap between CPUs */
+	if (!(atomic_load(&stack->nonempty) & bit))
+		atomic_fetch_or(&stack->nonempty, bit);
+
+	return 0;
+}
+
+int sheaf_prio_pop(sheaf_prio_t *stack, uintptr_t *ret, size_t *level,
+				   size_t ncpu)
+{
+	struct sheaf_lane *lvl;
+	sheaf_node_t *node = NULL;
+	sheaf_head_t head;
+	uint64_t bits;
+	percpu_t *pc;
+	size_t i, n;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	percpu_read_lock(pc);
+
+	/* Pop from the highest level that may hold values, and clear its bit
+	 * if it turns out to be empty */
+	while ((bits = atomic_load(&stack->nonempty))) {
+		i = prio_highest(bits);
+		lvl = &stack->levels[i];
+		head = sheaf_head_load(&lvl->head);
+		while (head.top) {
+			node = sheaf_head_try_pop(stack->percpu, &lvl->head, &head, 1,
+									  &n);
+			if (node)
+				break;
+			percpu_stat_add(pc, pop_retry, 1);
+			percpu_relax(pc);
+		}
+		if (node)
+			break;
+		prio_clear(stack, i);
+	}
+
+	percpu_read_unlock(pc);
+
+	if (!node) {
+		percpu_stat_add(pc, pop_empty, 1);
+		return -SHEAF_EAGAIN;
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = node->val;
+	if (level)
+		*level = i;
+
+	percpu_free_any_node(pc, node);
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Links of nodes in the queue are updated by several CPUs at once */
+static inline sheaf_node_t *queue_next(sheaf_node_t *node)
+{
+#ifdef SHEAF_SHARED
+	return __sheaf_ptr_decode(&node->next,
+							  __atomic_load_n(&node->next, __ATOMIC_ACQUIRE));
+#else
+	return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Link node after tail, unless another node was linked there first */
+static inline int queue_link(sheaf_node_t *tail, sheaf_node_t *node)
+{
+#ifdef SHEAF_SHARED
+	sheaf_off_t exp = 0, new = __sheaf_ptr_encode(&tail->next, node);
+#else
+	sheaf_node_t *exp = NULL, *new = node;
+#endif
+
+	return __atomic_compare_exchange_n(&tail->next, &exp, new, 1,
+									   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+int sheaf_queue_init(sheaf_queue_t *queue, size_t ncpus, pa_t *pa)
+{
+	sheaf_node_t *dummy;
+
+	if (!queue || !ncpus)
+		return -SHEAF_EINVAL;
+
+	queue->pa = pa;
+	queue->ncpus = ncpus;
+
+	queue->percpu = percpu_init(ncpus, sizeof(sheaf_node_t), pa);
+	if (!queue->percpu)
+		return -SHEAF_ENOMEM;
+
+	dummy = percpu_alloc_node(percpu_get(queue->percpu, 0));
+	if (!dummy) {
+		percpu_release(queue->percpu);
+		return -SHEAF_ENOMEM;
+	}
+	sheaf_node_set_next(dummy, NULL);
+	atomic_init(&queue->head, dummy);
+	atomic_init(&queue->tail, dummy);
+
+	return 0;
+}
+
+void sheaf_queue_release(sheaf_queue_t *queue)
+{
+	if (!queue)
+		return;
+
+	/* Nobody else uses the queue anymore. Give back every node in it,
+	 * dummy included */
+	percpu_free_chain(percpu_get(queue->percpu, 0), atomic_load(&queue->head));
+	percpu_release(queue->percpu);
+}
+
+int sheaf_enqueue(sheaf_queue_t *queue, uintptr_t val, size_t ncpu)
+{
+	sheaf_node_t *node, *tail, *next;
+	percpu_t *pc;
+
+	if (!queue || ncpu >= queue->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(queue->percpu, ncpu);
+	node = percpu_alloc_node(pc);
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	node->val = val;
+	sheaf_node_set_next(node, NULL);
+
+	/* The tail might be dequeued and retired while we link to it */
+	percpu_read_lock(pc);
+
+	while (1) {
+		tail = atomic_load(&queue->tail);
+		next = queue_next(tail);
+		if (tail != atomic_load(&queue->tail))
+			continue;
+
+		/* Another enqueue linked its node but has not moved the tail
+		 * yet. Do it for them */
+		if (next) {
+			atomic_compare_exchange_weak(&queue->tail, &tail, next);
+			continue;
+		}
+
+		if (queue_link(tail, node))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+
+	/* Failing is fine, someone else did it already */
+	atomic_compare_exchange_strong(&queue->tail, &tail, node);
+
+	percpu_read_unlock(pc);
+	percpu_stat_add(pc, push, 1);
+
+	return 0;
+}
+
+int sheaf_dequeue(sheaf_queue_t *queue, uintptr_t *ret, size_t ncpu)
+{
+	sheaf_node_t *head, *tail, *next;
+	percpu_t *pc;
+	uintptr_t val;
+
+	if (!queue || ncpu >= queue->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(queue->percpu, ncpu);
+	percpu_read_lock(pc);
+
+	while (1) {
+		head = atomic_load(&queue->head);
+		tail = atomic_load(&queue->tail);
+		next = queue_next(head);
+		if (head != atomic_load(&queue->head))
+			continue;
+
+		if (!next) {
+			percpu_read_unlock(pc);
+			percpu_stat_add(pc, pop_empty, 1);
+			return -SHEAF_EAGAIN;
+		}
+
+		/* Never move the head past the tail, so that a retired node is
+		 * never the tail */
+		if (head == tail) {
+			atomic_compare_exchange_weak(&queue->tail, &tail, next);
+			continue;
+		}
+
+		/* Read the value before the node becomes the dummy, which the
+		 * next dequeue might retire */
+		val = next->val;
+		if (atomic_compare_exchange_weak(&queue->head, &head, next))
+			break;
+		percpu_stat_add(pc, pop_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+
+	percpu_read_unlock(pc);
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = val;
+
+	percpu_retire_node(pc, head);
+
+	return 0;
+}
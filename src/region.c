@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "region.h"
+
+#define REGION_FREE_PGNO(head) ((head) & UINT32_MAX)
+#define REGION_FREE(head, pgno) (((((head) >> 32) + 1) << 32) | (pgno))
+
+static inline void *region_page(struct sheaf_region *r, uint64_t pgno)
+{
+	return (char *)r + pgno * PAGE_SIZE;
+}
+
+int sheaf_region_init(void *base, size_t size)
+{
+	struct sheaf_region *r = base;
+	size_t npages = size / PAGE_SIZE;
+
+	if (!base || (uintptr_t)base % PAGE_SIZE || npages < 2)
+		return -SHEAF_EINVAL;
+
+	/* Page numbers have to fit in the low half of the free list head */
+	if (npages > UINT32_MAX)
+		npages = UINT32_MAX;
+
+	r->npages = npages;
+	atomic_init(&r->next, 1);
+	atomic_init(&r->free, 0);
+	atomic_init(&r->root, 0);
+	atomic_store_explicit(&r->magic, SHEAF_REGION_MAGIC, memory_order_release);
+
+	return 0;
+}
+
+int sheaf_region_attach(void *base, size_t size)
+{
+	struct sheaf_region *r = base;
+
+	if (!base || (uintptr_t)base % PAGE_SIZE || size < PAGE_SIZE)
+		return -SHEAF_EINVAL;
+
+	if (atomic_load_explicit(&r->magic, memory_order_acquire) !=
+			SHEAF_REGION_MAGIC ||
+		r->npages > size / PAGE_SIZE)
+		return -SHEAF_EINVAL;
+
+	return 0;
+}
+
+void sheaf_region_pa(void *base, pa_t *pa)
+{
+	pa->opaque = base;
+	pa->alloc_page = sheaf_region_alloc_page;
+	pa->free_page = sheaf_region_free_page;
+}
+
+void *sheaf_region_alloc_page(void *base)
+{
+	struct sheaf_region *r = base;
+	uint64_t head, next, pgno;
+
+	/* Pages given back first. The one on top may be taken and written to
+	 * under our feet, in which case the counter has changed and the CAS
+	 * fails */
+	head = atomic_load_explicit(&r->free, memory_order_acquire);
+	while ((pgno = REGION_FREE_PGNO(head))) {
+		next = __atomic_load_n((uint64_t *)region_page(r, pgno),
+							   __ATOMIC_RELAXED);
+		if (atomic_compare_exchange_weak_explicit(
+					&r->free, &head, REGION_FREE(head, next),
+					memory_order_acquire, memory_order_acquire))
+			return region_page(r, pgno);
+	}
+
+	pgno = atomic_load_explicit(&r->next, memory_order_relaxed);
+	do {
+		if (pgno >= r->npages)
+			return NULL;
+	} while (!atomic_compare_exchange_weak_explicit(&r->next, &pgno, pgno + 1,
+													memory_order_relaxed,
+													memory_order_relaxed));
+
+	return region_page(r, pgno);
+}
+
+void sheaf_region_free_page(void *base, void *page)
+{
+	struct sheaf_region *r = base;
+	uint64_t head, pgno;
+
+	if (!page)
+		return;
+
+	pgno = ((uintptr_t)page - (uintptr_t)base) / PAGE_SIZE;
+	head = atomic_load_explicit(&r->free, memory_order_relaxed);
+	do {
+		__atomic_store_n((uint64_t *)page, REGION_FREE_PGNO(head),
+						 __ATOMIC_RELAXED);
+	} while (!atomic_compare_exchange_weak_explicit(
+			&r->free, &head, REGION_FREE(head, pgno), memory_order_release,
+			memory_order_relaxed));
+}
+
+/* The root is kept as an offset, since each process has its own base */
+void sheaf_region_set_root(void *base, void *obj)
+{
+	struct sheaf_region *r = base;
+
+	atomic_store_explicit(&r->root,
+						  obj ? (uintptr_t)obj - (uintptr_t)base : 0,
+						  memory_order_release);
+}
+
+void *sheaf_region_root(void *base)
+{
+	struct sheaf_region *r = base;
+	uint64_t off = atomic_load_explicit(&r->root, memory_order_acquire);
+
+	return off ? (char *)base + off : NULL;
+}
@@ -1,103 +1,584 @@
 // SPDX-License-Identifier: BSD-2-Clause
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <limits.h>
 #include <stdatomic.h>
 #include <stddef.h>
 
+#ifdef __linux__
+#include <sched.h>
+
+/* glibc 2.35 and later register an rseq area for every thread */
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_thread_pointer) &&                              \
+		(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#include <sys/rseq.h>
+#define SHEAF_RSEQ
+#endif
+#endif
+#endif
+
+#include "os.h"
+#include "park.h"
+#include "region.h"
 #include "sheaf.h"
 
+/* Arguments to print a head with "(%p, %lu)" */
+#define HEAD_DBG(h) (void *)(uintptr_t)(h).top, (unsigned long)(h).aba
+
 void sheaf_release(sheaf_t *stack)
 {
-	int ret;
-
 	if (!stack)
 		return;
 
-	do {
-		ret = sheaf_pop(stack, NULL, 0);
-	} while (ret != -SHEAF_EAGAIN);
-	percpu_release(stack->percpu, stack->ncpus, stack->pa);
+	sheaf_pop_all(stack, NULL, NULL, 0);
+	percpu_release(sheaf_dir(stack));
+}
+
+#if SHEAF_ELIM_SLOTS > 0
+
+/* Marks a slot whose node has been taken by a pop */
+#define SHEAF_ELIM_TAKEN ((sheaf_node_t *)1)
+
+static void sheaf_elim_init(sheaf_t *stack)
+{
+	size_t i;
+
+	for (i = 0; i < SHEAF_ELIM_SLOTS; ++i)
+		atomic_init(&stack->elim[i].node, NULL);
 }
 
+/*
+ * Offer a node to a concurrent pop through the elimination array. Returns 1
+ * if a pop took the node, in which case the push is complete without ever
+ * touching the head.
+ */
+static int sheaf_elim_push(sheaf_t *stack, sheaf_node_t *node, size_t ncpu)
+{
+	_Atomic(sheaf_node_t *) *slot = &stack->elim[ncpu % SHEAF_ELIM_SLOTS].node;
+	sheaf_node_t *exp = NULL;
+	size_t i;
+
+	if (!atomic_compare_exchange_strong_explicit(
+				slot, &exp, node, memory_order_release, memory_order_relaxed))
+		return 0;
+
+	for (i = 0; i < SHEAF_ELIM_SPINS; ++i) {
+		if (atomic_load_explicit(slot, memory_order_relaxed) != node)
+			break;
+		__sheaf_relax();
+	}
+
+	/* Withdraw the offer. If we cannot, a pop took the node, and only we
+	 * can release the slot */
+	exp = node;
+	if (atomic_compare_exchange_strong_explicit(
+				slot, &exp, NULL, memory_order_relaxed, memory_order_relaxed))
+		return 0;
+
+	DBG_ASSERT(exp == SHEAF_ELIM_TAKEN);
+	atomic_store_explicit(slot, NULL, memory_order_relaxed);
+	return 1;
+}
+
+/* Take a node offered by a concurrent push, if any */
+static sheaf_node_t *sheaf_elim_pop(sheaf_t *stack, size_t ncpu)
+{
+	_Atomic(sheaf_node_t *) *slot;
+	sheaf_node_t *node;
+	size_t i;
+
+	for (i = 0; i < SHEAF_ELIM_SLOTS; ++i) {
+		slot = &stack->elim[(ncpu + i) % SHEAF_ELIM_SLOTS].node;
+		node = atomic_load_explicit(slot, memory_order_relaxed);
+		if (!node || node == SHEAF_ELIM_TAKEN)
+			continue;
+		if (atomic_compare_exchange_strong_explicit(slot, &node,
+													SHEAF_ELIM_TAKEN,
+													memory_order_acquire,
+													memory_order_relaxed))
+			return node;
+	}
+
+	return NULL;
+}
+
+#else
+
+static inline void sheaf_elim_init(sheaf_t *stack)
+{
+	(void)stack;
+}
+
+static inline int sheaf_elim_push(sheaf_t *stack, sheaf_node_t *node,
+								  size_t ncpu)
+{
+	(void)stack;
+	(void)node;
+	(void)ncpu;
+	return 0;
+}
+
+static inline sheaf_node_t *sheaf_elim_pop(sheaf_t *stack, size_t ncpu)
+{
+	(void)stack;
+	(void)ncpu;
+	return NULL;
+}
+
+#endif
+
 int sheaf_init(sheaf_t *stack, size_t ncpus, pa_t *pa)
 {
+	struct percpu_dir *dir;
+
 	if (!stack || !ncpus)
 		return -SHEAF_EINVAL;
+#ifdef SHEAF_SHARED
+	/* Other processes cannot call the page allocator of this one, so every
+	 * page of the stack must come from its region */
+	if (pa && pa->alloc_page != sheaf_region_alloc_page)
+		return -SHEAF_EINVAL;
+#endif
 
 	stack->pa = pa;
 	stack->ncpus = ncpus;
-	atomic_init(&stack->head, (sheaf_head_t){ 0 });
+	atomic_init(&stack->waiters, 0);
+	atomic_init(&stack->wake_seq, 0);
+	sheaf_head_init(&stack->head, (sheaf_head_t){ 0 });
+	sheaf_elim_init(stack);
 
-	stack->percpu = percpu_init(ncpus, pa);
-	if (!stack->percpu)
+	dir = percpu_init(ncpus, sizeof(sheaf_node_t), pa);
+	if (!dir)
 		return -SHEAF_ENOMEM;
+	sheaf_ptr_set(stack->percpu, dir);
 
 	return 0;
 }
 
 int sheaf_push(sheaf_t *stack, uintptr_t val, size_t ncpu)
 {
-	sheaf_head_t head, new;
+	struct percpu_dir *dir;
+	sheaf_head_t head;
 	sheaf_node_t *node;
+	percpu_t *pc;
 
 	if (!stack || ncpu >= stack->ncpus)
 		return -SHEAF_EINVAL;
 
-	node = percpu_alloc_node(&stack->percpu[ncpu], stack->pa);
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	node = percpu_alloc_node(pc);
 	if (!node)
 		return -SHEAF_ENOMEM;
 
 	node->val = val;
-	node->ncpu = ncpu;
 
-	head = atomic_load(&stack->head);
+	head = sheaf_head_load(&stack->head);
+	while (1) {
+		if (sheaf_head_try_push(dir, &stack->head, &head, node, node))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+
+		/* We are contending with others. If one of them is a pop, try
+		 * to hand the node over directly */
+		if (sheaf_elim_push(stack, node, ncpu)) {
+			DBG("t=%02lu Eliminated push: %p\n", ncpu, (void *)node);
+			percpu_stat_add(pc, elim_push, 1);
+			percpu_stat_add(pc, push, 1);
+			return 0;
+		}
+		percpu_relax(pc);
+	};
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, 1);
+	sheaf_wake(stack, 1);
+
+	DBG("t=%02lu Updated head (push): (%p, %lu) -> %p\n", ncpu,
+		HEAD_DBG(head), (void *)node);
+
+	return 0;
+}
+
+int sheaf_push_bulk(sheaf_t *stack, const uintptr_t *vals, size_t n,
+					size_t ncpu)
+{
+	sheaf_node_t *first = NULL, *last = NULL, *node;
+	struct percpu_dir *dir;
+	sheaf_head_t head;
+	percpu_t *pc;
+	size_t i;
+
+	if (!stack || (n && !vals) || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	if (!n)
+		return 0;
+
+	/* Link all the nodes locally first. The chain is built in reverse, so
+	 * that once it is published the last value ends up on top of the
+	 * stack, same as with n calls to sheaf_push() */
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	for (i = 0; i < n; ++i) {
+		node = percpu_alloc_node(pc);
+		if (!node) {
+			/* Give back the nodes we took so far */
+			while (first) {
+				node = first;
+				first = sheaf_node_next(first);
+				percpu_free_node(pc, node);
+			}
+			return -SHEAF_ENOMEM;
+		}
+
+		node->val = vals[i];
+		sheaf_node_set_next(node, first);
+		if (!last)
+			last = node;
+		first = node;
+	}
+
+	/* Publish the whole chain at once */
+	head = sheaf_head_load(&stack->head);
+	while (1) {
+		if (sheaf_head_try_push(dir, &stack->head, &head, first, last))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	};
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, n);
+	sheaf_wake(stack, n);
+
+	DBG("t=%02lu Updated head (push_bulk): (%p, %lu) -> %p\n", ncpu,
+		HEAD_DBG(head), (void *)first);
+
+	return 0;
+}
+
+int sheaf_pop_bulk(sheaf_t *stack, uintptr_t *ret, size_t max, size_t ncpu)
+{
+	struct percpu_dir *dir;
+	sheaf_head_t head;
+	sheaf_node_t *first, *node;
+	percpu_t *pc;
+	size_t i, n;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	if (!max)
+		return 0;
+	if (max > INT_MAX)
+		max = INT_MAX;
+
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	percpu_read_lock(pc);
+
+	head = sheaf_head_load(&stack->head);
+	while (1) {
+		if (!head.top) {
+			percpu_read_unlock(pc);
+			percpu_stat_add(pc, pop_empty, 1);
+			return -SHEAF_EAGAIN;
+		}
+
+		first = sheaf_head_try_pop(dir, &stack->head, &head, max, &n);
+		if (first)
+			break;
+		percpu_stat_add(pc, pop_retry, 1);
+		percpu_relax(pc);
+	};
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, pop, n);
+
+	percpu_read_unlock(pc);
+
+	DBG("t=%02lu Updated head (pop_bulk):  (%p, %lu) -> %zu nodes\n", ncpu,
+		HEAD_DBG(head), n);
+
+	/* The chain is now ours. Cut it where the new top begins */
+	node = first;
+	for (i = 0; i < n - 1; ++i) {
+		if (ret)
+			ret[i] = node->val;
+		node = sheaf_node_next(node);
+	}
+	if (ret)
+		ret[i] = node->val;
+	sheaf_node_set_next(node, NULL);
+
+	percpu_free_chain(pc, first);
+
+	return (int)n;
+}
+
+int sheaf_pop_all(sheaf_t *stack, void (*fn)(uintptr_t, void *), void *opaque,
+				  size_t ncpu)
+{
+	sheaf_head_t head, new;
+	sheaf_node_t *first, *node;
+	percpu_t *pc;
+	size_t n;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(sheaf_dir(stack), ncpu);
+
+	head = sheaf_head_load(&stack->head);
 	while (1) {
-		node->next = head.top;
-		new.top = node;
+		if (!head.top) {
+			percpu_stat_add(pc, pop_empty, 1);
+			return -SHEAF_EAGAIN;
+		}
+		new.top = 0;
 		new.aba = head.aba + 1;
-		if (atomic_compare_exchange_weak(&stack->head, &head, new))
+		if (sheaf_head_cas(&stack->head, &head, new))
 			break;
-		__sheaf_relax();
+		percpu_stat_add(pc, pop_retry, 1);
+		percpu_relax(pc);
 	};
+	percpu_relax_done(pc);
+
+	DBG("t=%02lu Updated head (pop_all):  (%p, %lu) -> (%p, %lu)\n", ncpu,
+		HEAD_DBG(head), HEAD_DBG(new));
 
-	DBG("t=%02lu Updated head (push): (%p, %lu) -> (%p, %lu)\n", ncpu,
-		(void *)head.top, head.aba, (void *)new.top, new.aba);
+	/* The whole chain is now ours. Hand out the values in stack order
+	 * before giving back the nodes */
+	first = sheaf_ref_node(sheaf_dir(stack), head.top);
+	if (fn) {
+		for (node = first; node; node = sheaf_node_next(node))
+			fn(node->val, opaque);
+	}
+
+	n = percpu_free_chain(pc, first);
+	percpu_stat_add(pc, pop, n);
 
 	return 0;
 }
 
+int sheaf_stats_read(sheaf_t *stack, struct sheaf_stats *stats)
+{
+	if (!stack || !stats)
+		return -SHEAF_EINVAL;
+
+	percpu_stats_read(sheaf_dir(stack), stats);
+
+	return 0;
+}
+
+int sheaf_shrink(sheaf_t *stack, size_t ncpu, size_t keep)
+{
+	struct percpu_dir *dir;
+	sheaf_node_t *pages;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	dir = sheaf_dir(stack);
+	pages = percpu_shrink(percpu_get(dir, ncpu), keep);
+	if (!pages)
+		return 0;
+
+	/* A pop might still be reading a node in these pages through a stale
+	 * head. Wait for all of them to finish before giving the pages back */
+	percpu_synchronize(dir);
+
+	return (int)percpu_free_pages(dir, pages);
+}
+
 int sheaf_pop(sheaf_t *stack, uintptr_t *ret, size_t ncpu)
 {
-	sheaf_head_t head, new;
+	struct percpu_dir *dir;
+	sheaf_head_t head;
 	sheaf_node_t *node;
-	percpu_t *percpus;
+	percpu_t *pc;
+	size_t n;
 
 	if (!stack || ncpu >= stack->ncpus)
 		return -SHEAF_EINVAL;
 
-	head = atomic_load(&stack->head);
+	dir = sheaf_dir(stack);
+	pc = percpu_get(dir, ncpu);
+	percpu_read_lock(pc);
+
+	head = sheaf_head_load(&stack->head);
 	while (1) {
-		if (!head.top)
+		if (!head.top) {
+			percpu_read_unlock(pc);
+			percpu_stat_add(pc, pop_empty, 1);
 			return -SHEAF_EAGAIN;
-		new.top = head.top->next;
-		new.aba = head.aba + 1;
-		if (atomic_compare_exchange_weak(&stack->head, &head, new))
+		}
+		node = sheaf_head_try_pop(dir, &stack->head, &head, 1, &n);
+		if (node) {
+			DBG("t=%02lu Updated head (pop):  (%p, %lu) -> %p\n", ncpu,
+				HEAD_DBG(head), (void *)sheaf_node_next(node));
 			break;
-		__sheaf_relax();
+		}
+		percpu_stat_add(pc, pop_retry, 1);
+
+		/* Try to take a node from a push we are colliding with */
+		node = sheaf_elim_pop(stack, ncpu);
+		if (node) {
+			DBG("t=%02lu Eliminated pop: %p\n", ncpu, (void *)node);
+			percpu_stat_add(pc, elim_pop, 1);
+			break;
+		}
+		percpu_relax(pc);
 	};
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, pop, 1);
 
-	DBG("t=%02lu Updated head (pop):  (%p, %lu) -> (%p, %lu)\n", ncpu,
-		(void *)head.top, head.aba, (void *)new.top, new.aba);
+	percpu_read_unlock(pc);
 
-	node = head.top;
 	if (ret)
 		*ret = node->val;
 
-	/* Now free this node. If it is in our percpu pool we can do it
-	 * ourselves. If not, we need to push it to that cpu's ringbuffer */
-	percpus = stack->percpu;
-	if (node->ncpu == ncpu)
-		percpu_free_node(&percpus[ncpu], node);
-	else
-		percpu_free_remote_node(&percpus[ncpu], &percpus[node->ncpu], node);
+	percpu_free_any_node(pc, node);
 
 	return 0;
 }
+
+int sheaf_pop_wait(sheaf_t *stack, uintptr_t *ret, size_t ncpu,
+				   uint64_t timeout_ns)
+{
+	uint64_t now, deadline = SHEAF_WAIT_FOREVER;
+	uint32_t seq;
+	size_t i;
+	int err;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	if (timeout_ns != SHEAF_WAIT_FOREVER) {
+		deadline = __sheaf_clock_ns() + timeout_ns;
+		if (deadline < timeout_ns)
+			deadline = SHEAF_WAIT_FOREVER;
+	}
+
+	while (1) {
+		/* A push might be on its way, which is cheaper to wait for
+		 * than a trip through the scheduler */
+		for (i = 0; i < SHEAF_WAIT_SPINS; ++i) {
+			if (sheaf_head_load(&stack->head).top)
+				break;
+			__sheaf_relax();
+		}
+
+		err = sheaf_pop(stack, ret, ncpu);
+		if (err != -SHEAF_EAGAIN)
+			return err;
+
+		now = deadline == SHEAF_WAIT_FOREVER ? 0 : __sheaf_clock_ns();
+		if (now >= deadline)
+			return -SHEAF_ETIMEDOUT;
+
+		/* Let pushes know we are here before checking the stack one
+		 * last time. A push after that bumps wake_seq, so we do not
+		 * sleep through it */
+		seq = atomic_load(&stack->wake_seq);
+		atomic_fetch_add(&stack->waiters, 1);
+		/* The head may be loaded with acquire semantics only, which
+		 * would let the check be done before the increment */
+		atomic_thread_fence(memory_order_seq_cst);
+		if (!sheaf_head_load(&stack->head).top)
+			__sheaf_park(&stack->wake_seq, seq,
+						 deadline == SHEAF_WAIT_FOREVER ? SHEAF_WAIT_FOREVER :
+														  deadline - now);
+		atomic_fetch_sub(&stack->waiters, 1);
+	}
+}
+
+/* CPU the calling thread is running on. It may be moved to another one right
+ * after, so this is only a hint */
+static size_t sheaf_current_cpu(void)
+{
+#ifdef __linux__
+	int cpu;
+#ifdef SHEAF_RSEQ
+	struct rseq *rs;
+
+	/* The kernel keeps the current CPU up to date in the rseq area, which
+	 * makes this a single load instead of a call */
+	if (__rseq_size) {
+		rs = (struct rseq *)((char *)__builtin_thread_pointer() +
+							 __rseq_offset);
+		return __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+	}
+#endif
+	cpu = sched_getcpu();
+	return cpu >= 0 ? (size_t)cpu : 0;
+#else
+	return __sheaf_os_cpu();
+#endif
+}
+
+/*
+ * Claim the per-CPU structure of the CPU we are running on. Another thread
+ * holds it if it was preempted or moved to another CPU in the middle of an
+ * operation, in which case we try the next CPUs rather than wait for it. This
+ * is a try-lock, not a restartable sequence: when all of them are held, we
+ * spin over them until a holder gets to run again.
+ */
+static percpu_t *sheaf_claim_cpu(sheaf_t *stack)
+{
+	size_t ncpu = sheaf_current_cpu() % stack->ncpus, tries = 0;
+	percpu_t *pc;
+
+	while (1) {
+		pc = percpu_get(sheaf_dir(stack), ncpu);
+		if (!atomic_flag_test_and_set_explicit(&pc->claimed,
+											   memory_order_acquire))
+			break;
+
+		/* All of them are taken when there are more threads in the
+		 * middle of an operation than the stack has CPUs. Some of them
+		 * have been preempted, so let them run */
+		if (++tries % stack->ncpus == 0)
+			__sheaf_os_relax();
+		if (++ncpu == stack->ncpus)
+			ncpu = 0;
+	}
+	percpu_stat_add(pc, cpu_busy, tries);
+
+	return pc;
+}
+
+static inline void sheaf_unclaim_cpu(percpu_t *pc)
+{
+	atomic_flag_clear_explicit(&pc->claimed, memory_order_release);
+}
+
+int sheaf_push_cpu(sheaf_t *stack, uintptr_t val)
+{
+	percpu_t *pc;
+	int ret;
+
+	if (!stack)
+		return -SHEAF_EINVAL;
+
+	pc = sheaf_claim_cpu(stack);
+	ret = sheaf_push(stack, val, pc->ncpu);
+	sheaf_unclaim_cpu(pc);
+
+	return ret;
+}
+
+int sheaf_pop_cpu(sheaf_t *stack, uintptr_t *ret)
+{
+	percpu_t *pc;
+	int err;
+
+	if (!stack)
+		return -SHEAF_EINVAL;
+
+	pc = sheaf_claim_cpu(stack);
+	err = sheaf_pop(stack, ret, pc->ncpu);
+	sheaf_unclaim_cpu(pc);
+
+	return err;
+}
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "spmc.h"
+
+int sheaf_spmc_init(sheaf_spmc_t *stack, size_t ncpus, pa_t *pa)
+{
+	if (!stack || !ncpus)
+		return -SHEAF_EINVAL;
+
+	stack->pa = pa;
+	stack->ncpus = ncpus;
+	atomic_init(&stack->top, NULL);
+
+	stack->percpu = percpu_init(ncpus, sizeof(sheaf_node_t), pa);
+	if (!stack->percpu)
+		return -SHEAF_ENOMEM;
+
+	return 0;
+}
+
+void sheaf_spmc_release(sheaf_spmc_t *stack)
+{
+	if (!stack)
+		return;
+
+	/* Nobody else uses the stack anymore. Retired nodes are given back
+	 * by percpu_release() */
+	percpu_free_chain(percpu_get(stack->percpu, 0), atomic_load(&stack->top));
+	percpu_release(stack->percpu);
+}
+
+int sheaf_spmc_push(sheaf_spmc_t *stack, uintptr_t val, size_t ncpu)
+{
+	sheaf_node_t *node, *top;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+	node = percpu_alloc_node(pc);
+	if (!node)
+		return -SHEAF_ENOMEM;
+
+	node->val = val;
+
+	/* Pops may move the head under our feet, but whatever it points to
+	 * when the CAS succeeds is the right next node */
+	top = atomic_load_explicit(&stack->top, memory_order_relaxed);
+	while (1) {
+		sheaf_node_set_next(node, top);
+		if (atomic_compare_exchange_weak_explicit(&stack->top, &top, node,
+												  memory_order_release,
+												  memory_order_relaxed))
+			break;
+		percpu_stat_add(pc, push_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+	percpu_stat_add(pc, push, 1);
+
+	return 0;
+}
+
+int sheaf_spmc_pop(sheaf_spmc_t *stack, uintptr_t *ret, size_t ncpu)
+{
+	sheaf_node_t *node;
+	percpu_t *pc;
+
+	if (!stack || ncpu >= stack->ncpus)
+		return -SHEAF_EINVAL;
+
+	pc = percpu_get(stack->percpu, ncpu);
+
+	/* The top node may be popped by someone else while we read it. It is
+	 * then retired, and cannot come back on top until we are done */
+	percpu_read_lock(pc);
+
+	node = atomic_load_explicit(&stack->top, memory_order_acquire);
+	while (1) {
+		if (!node) {
+			percpu_read_unlock(pc);
+			percpu_stat_add(pc, pop_empty, 1);
+			return -SHEAF_EAGAIN;
+		}
+		if (atomic_compare_exchange_weak_explicit(&stack->top, &node,
+												  sheaf_node_next(node),
+												  memory_order_acquire,
+												  memory_order_acquire))
+			break;
+		percpu_stat_add(pc, pop_retry, 1);
+		percpu_relax(pc);
+	}
+	percpu_relax_done(pc);
+
+	percpu_read_unlock(pc);
+	percpu_stat_add(pc, pop, 1);
+
+	if (ret)
+		*ret = node->val;
+
+	percpu_retire_node(pc, node);
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef _SHEAF_BASELINE_H
+#define _SHEAF_BASELINE_H
+
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arch.h"
+
+/*
+ * A plain stack protected by either a spinlock or a mutex, used as a baseline
+ * to compare sheaf against.
+ */
+
+typedef struct node {
+	struct node *next;
+	uintptr_t val;
+} node_t;
+
+typedef struct stack {
+	struct node *head;
+} stack_t;
+
+typedef struct lock {
+	int mutex;
+	union {
+		pthread_mutex_t m;
+		pthread_spinlock_t s;
+	};
+} lock_t;
+
+static inline void lock_init(lock_t *lock, int mutex)
+{
+	lock->mutex = mutex;
+	if (mutex) {
+		if (pthread_mutex_init(&lock->m, NULL))
+			err(EXIT_FAILURE, "pthread_mutex_init");
+	} else {
+		if (pthread_spin_init(&lock->s, PTHREAD_PROCESS_PRIVATE))
+			err(EXIT_FAILURE, "pthread_spin_init");
+	}
+}
+
+static inline void lock_destroy(lock_t *lock)
+{
+	if (lock->mutex) {
+		if (pthread_mutex_destroy(&lock->m))
+			warn("pthread_mutex_destroy");
+	} else {
+		if (pthread_spin_destroy(&lock->s))
+			warn("pthread_spin_destroy");
+	}
+}
+
+static inline void lock_lock(lock_t *lock)
+{
+	if (lock->mutex) {
+		while (pthread_mutex_lock(&lock->m)) {
+		}
+		return;
+	}
+
+	while (pthread_spin_trylock(&lock->s))
+		__sheaf_arch_relax();
+}
+
+static inline void lock_unlock(lock_t *lock)
+{
+	if (lock->mutex) {
+		while (pthread_mutex_unlock(&lock->m)) {
+		}
+		return;
+	}
+
+	while (pthread_spin_unlock(&lock->s)) {
+	}
+}
+
+static inline node_t *stack_pop(stack_t *stack)
+{
+	node_t *node = NULL;
+
+	node = stack->head;
+	if (node)
+		stack->head = node->next;
+	return node;
+}
+
+static inline void stack_push(stack_t *stack, node_t *node)
+{
+	node->next = stack->head;
+	stack->head = node;
+}
+
+static inline void stack_release(stack_t *stack)
+{
+	node_t *node;
+
+	do {
+		node = stack_pop(stack);
+		if (node)
+			free(node);
+	} while (node);
+}
+
+#endif
@@ -5,12 +5,66 @@
 #include <bits/pthreadtypes.h>
 #include <err.h>
 #include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
 
 #include "sheaf.h"
 
+#ifdef SHEAF_SHARED
+
+#include <sys/mman.h>
+
+#include "region.h"
+
+/*
+ * Stacks built with SHEAF_SHARED only take pages from a region, so both
+ * allocators hand out pages of a region of their own. The regions are mapped
+ * without reserving memory, and only take up the pages that were used.
+ */
+#define TEST_REGION_SIZE (8UL << 30)
+
+pa_t pa, count_pa;
+static void *count_region;
+
+static void *test_region(void)
+{
+	void *base;
+
+	base = mmap(NULL, TEST_REGION_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+	if (sheaf_region_init(base, TEST_REGION_SIZE))
+		errx(EXIT_FAILURE, "sheaf_region_init");
+
+	return base;
+}
+
+__attribute__((constructor)) static void test_regions_init(void)
+{
+	sheaf_region_pa(test_region(), &pa);
+	count_region = test_region();
+	sheaf_region_pa(count_region, &count_pa);
+}
+
+/* Pages of count_pa in use, i.e. handed out and not on the free list of its
+ * region. Only meaningful while no page is allocated or freed */
+static inline size_t pages_used(void)
+{
+	struct sheaf_region *r = count_region;
+	uint64_t pgno = atomic_load(&r->free) & UINT32_MAX;
+	size_t n = atomic_load(&r->next) - 1;
+
+	for (; pgno; --n)
+		pgno = *(uint64_t *)((char *)r + pgno * PAGE_SIZE);
+
+	return n;
+}
+
+#else
+
 static void *alloc_page(void *opaque)
 {
 	void *page = NULL;
@@ -33,6 +87,33 @@ pa_t pa = {
 	.free_page = free_page,
 };
 
+/* Same as pa, keeping count of the pages in use to catch leaks */
+static _Atomic size_t pages_in_use = 0;
+
+static void *count_alloc_page(void *opaque)
+{
+	atomic_fetch_add(&pages_in_use, 1);
+	return alloc_page(opaque);
+}
+
+static void count_free_page(void *opaque, void *page)
+{
+	atomic_fetch_sub(&pages_in_use, 1);
+	free_page(opaque, page);
+}
+
+pa_t count_pa = {
+	.alloc_page = count_alloc_page,
+	.free_page = count_free_page,
+};
+
+static inline size_t pages_used(void)
+{
+	return atomic_load(&pages_in_use);
+}
+
+#endif
+
 static inline void barrier_wait(pthread_barrier_t *barrier)
 {
 	int ret;
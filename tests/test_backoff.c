@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <err.h>
+#include <stdlib.h>
+
+/* Bounds that are not powers of two, so that neither is reached exactly by
+ * doubling or halving the window */
+#undef SHEAF_BACKOFF_MIN
+#undef SHEAF_BACKOFF_MAX
+#undef SHEAF_BACKOFF_YIELD
+#define SHEAF_BACKOFF_MIN 3
+#define SHEAF_BACKOFF_MAX 1000
+#define SHEAF_BACKOFF_YIELD 0
+
+#include "backoff.h"
+
+int main(int argc, const char *argv[])
+{
+	struct sheaf_backoff bo;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	__sheaf_backoff_init(&bo, 1);
+
+	/* The window grows up to the maximum, and stays there */
+	for (i = 0; i < 32; ++i) {
+		__sheaf_backoff_relax(&bo);
+		if (bo.window > SHEAF_BACKOFF_MAX)
+			errx(EXIT_FAILURE, "window %u above %u", bo.window,
+				 SHEAF_BACKOFF_MAX);
+	}
+	if (bo.window != SHEAF_BACKOFF_MAX)
+		errx(EXIT_FAILURE, "window %u, expected %u", bo.window,
+			 SHEAF_BACKOFF_MAX);
+
+	/* And shrinks down to the minimum */
+	for (i = 0; i < 32; ++i) {
+		__sheaf_backoff_done(&bo);
+		if (bo.window < SHEAF_BACKOFF_MIN)
+			errx(EXIT_FAILURE, "window %u below %u", bo.window,
+				 SHEAF_BACKOFF_MIN);
+	}
+	if (bo.window != SHEAF_BACKOFF_MIN)
+		errx(EXIT_FAILURE, "window %u, expected %u", bo.window,
+			 SHEAF_BACKOFF_MIN);
+
+	return EXIT_SUCCESS;
+}
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "baseline.h"
 #include "libtest.h"
 
 #ifndef NTHREADS
@@ -17,108 +18,13 @@
 #define NELEMS 0x2000UL
 #endif
 
+/* Use a mutex instead of a spinlock */
 #ifdef _BASELINE_MUTEX
-
-typedef pthread_mutex_t lock_t;
-
-static inline void lock_init(lock_t *lock)
-{
-	if (pthread_mutex_init(lock, NULL))
-		err(EXIT_FAILURE, "pthread_mutex_init");
-}
-
-static inline void lock_destroy(lock_t *lock)
-{
-	if (pthread_mutex_destroy(lock))
-		warn("pthread_mutex_destroy");
-}
-
-static inline void lock_lock(lock_t *lock)
-{
-	while (pthread_mutex_lock(lock)) {
-	}
-}
-
-static inline void lock_unlock(lock_t *lock)
-{
-	while (pthread_mutex_unlock(lock)) {
-	}
-}
-
+#define BASELINE_MUTEX 1
 #else
-
-#include "arch.h"
-
-typedef pthread_spinlock_t lock_t;
-
-static inline void lock_init(lock_t *lock)
-{
-	if (pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE))
-		err(EXIT_FAILURE, "pthread_spin_init");
-}
-
-static inline void lock_destroy(lock_t *lock)
-{
-	if (pthread_spin_destroy(lock))
-		warn("pthread_mutex_destroy");
-}
-
-static inline void lock_lock(pthread_spinlock_t *lock)
-{
-	int ret;
-
-	while (1) {
-		ret = pthread_spin_trylock(lock);
-		if (!ret)
-			break;
-		__sheaf_arch_relax();
-	}
-}
-
-static inline void lock_unlock(lock_t *lock)
-{
-	while (pthread_spin_unlock(lock)) {
-	}
-}
-
+#define BASELINE_MUTEX 0
 #endif
 
-typedef struct node {
-	struct node *next;
-	uintptr_t val;
-} node_t;
-
-typedef struct stack {
-	struct node *head;
-} stack_t;
-
-static node_t *stack_pop(stack_t *stack)
-{
-	node_t *node = NULL;
-
-	node = stack->head;
-	if (node)
-		stack->head = node->next;
-	return node;
-}
-
-static void stack_push(stack_t *stack, node_t *node)
-{
-	node->next = stack->head;
-	stack->head = node;
-}
-
-static void stack_release(stack_t *stack)
-{
-	node_t *node;
-
-	do {
-		node = stack_pop(stack);
-		if (node)
-			free(node);
-	} while (node);
-}
-
 static _Atomic size_t counters[NTHREADS] = { 0 };
 
 struct args {
@@ -215,7 +121,7 @@ int main(int argc, const char *argv[])
 	if (pthread_barrier_init(&barrier, NULL, NTHREADS * 2))
 		err(EXIT_FAILURE, "pthread_barrier_init");
 
-	lock_init(&lock);
+	lock_init(&lock, BASELINE_MUTEX);
 
 	for (i = 0; i < NTHREADS; ++i) {
 		arg = &args[i];
@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+#ifndef NTHREADS
+#define NTHREADS 8UL
+#endif
+
+#ifndef NELEMS
+#define NELEMS 0x2000UL
+#endif
+
+#ifndef BURST
+#define BURST 64UL
+#endif
+
+static size_t _Atomic counters[NTHREADS] = { 0 };
+
+struct args {
+	sheaf_t *stack;
+	size_t count;
+	uintptr_t val;
+	size_t id;
+	pthread_barrier_t *barrier;
+	int num_cores;
+};
+
+static void *push_worker(void *ctx)
+{
+	struct args *args = ctx;
+	sheaf_t *stack = args->stack;
+	uintptr_t vals[BURST];
+	size_t i, n;
+	int ret;
+
+	for (i = 0; i < BURST; ++i)
+		vals[i] = args->val;
+
+	pin_to_core(args->id, args->num_cores);
+	barrier_wait(args->barrier);
+
+	for (i = 0; i < args->count; i += n) {
+		n = args->count - i;
+		if (n > BURST)
+			n = BURST;
+
+		do {
+			ret = sheaf_push_bulk(stack, vals, n, args->id);
+		} while (ret == -SHEAF_ENOMEM);
+
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_push_bulk: %s", strerror(-ret));
+	}
+
+	return NULL;
+}
+
+static void *pop_worker(void *ctx)
+{
+	struct args *args = ctx;
+	sheaf_t *stack = args->stack;
+	uintptr_t vals[BURST];
+	size_t i = 0, j, max;
+	int ret;
+
+	pin_to_core(args->id, args->num_cores);
+	barrier_wait(args->barrier);
+
+	while (i < args->count) {
+		max = args->count - i;
+		if (max > BURST)
+			max = BURST;
+
+		ret = sheaf_pop_bulk(stack, vals, max, args->id);
+		if (ret == -SHEAF_EAGAIN)
+			continue;
+		if (ret < 0)
+			errx(EXIT_FAILURE, "sheaf_pop_bulk: %s", strerror(-ret));
+
+		for (j = 0; j < (size_t)ret; ++j)
+			atomic_fetch_add_explicit(&counters[vals[j]], 1,
+									  memory_order_relaxed);
+		i += ret;
+	}
+
+	return NULL;
+}
+
+static void args_init(struct args *arg, sheaf_t *stack,
+					  pthread_barrier_t *barrier, size_t i, int num_cores)
+{
+	arg->stack = stack;
+	arg->count = NELEMS;
+	arg->val = i;
+	arg->id = i;
+	arg->barrier = barrier;
+	arg->num_cores = num_cores;
+}
+
+/* Bulk operations must keep the same order as single ones */
+static int check_order(void)
+{
+	uintptr_t in[] = { 1, 2, 3, 4, 5 }, out[8], val;
+	sheaf_t stack;
+	int ret;
+
+	if (sheaf_init(&stack, 1, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	if (sheaf_push_bulk(&stack, in, 5, 0) || sheaf_push(&stack, 6, 0))
+		errx(EXIT_FAILURE, "sheaf_push_bulk");
+
+	ret = sheaf_pop(&stack, &val, 0);
+	if (ret || val != 6) {
+		warnx("sheaf_pop(): returned %d, value %lu, expected 6", ret, val);
+		return 1;
+	}
+
+	ret = sheaf_pop_bulk(&stack, out, 2, 0);
+	if (ret != 2 || out[0] != 5 || out[1] != 4) {
+		warnx("sheaf_pop_bulk(max=2): returned %d, expected 2", ret);
+		return 1;
+	}
+
+	ret = sheaf_pop_bulk(&stack, out, 8, 0);
+	if (ret != 3 || out[0] != 3 || out[1] != 2 || out[2] != 1) {
+		warnx("sheaf_pop_bulk(max=8): returned %d, expected 3", ret);
+		return 1;
+	}
+
+	ret = sheaf_pop_bulk(&stack, out, 8, 0);
+	if (ret != -SHEAF_EAGAIN) {
+		warnx("sheaf_pop_bulk(): returned %d, expected %d", ret,
+			  -SHEAF_EAGAIN);
+		return 1;
+	}
+
+	sheaf_release(&stack);
+	return 0;
+}
+
+static void sum_vals(uintptr_t val, void *opaque)
+{
+	uintptr_t *sum = opaque;
+
+	*sum += val;
+}
+
+/* Drain a stack holding nodes from several CPUs at once */
+static int check_pop_all(void)
+{
+	uintptr_t sum = 0, exp = 0, val;
+	sheaf_t stack;
+	size_t i;
+	int ret;
+
+	if (sheaf_init(&stack, 4, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	for (i = 0; i < 1000; ++i) {
+		if (sheaf_push(&stack, i, i % 4))
+			errx(EXIT_FAILURE, "sheaf_push");
+		exp += i;
+	}
+
+	ret = sheaf_pop_all(&stack, sum_vals, &sum, 1);
+	if (ret || sum != exp) {
+		warnx("sheaf_pop_all(): returned %d, sum %lu, expected %lu", ret, sum,
+			  exp);
+		return 1;
+	}
+
+	ret = sheaf_pop(&stack, &val, 0);
+	if (ret != -SHEAF_EAGAIN) {
+		warnx("sheaf_pop(): returned %d, expected %d", ret, -SHEAF_EAGAIN);
+		return 1;
+	}
+
+	ret = sheaf_pop_all(&stack, sum_vals, &sum, 1);
+	if (ret != -SHEAF_EAGAIN) {
+		warnx("sheaf_pop_all(): returned %d, expected %d", ret,
+			  -SHEAF_EAGAIN);
+		return 1;
+	}
+
+	sheaf_release(&stack);
+	return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	sheaf_t stack;
+	size_t i;
+	pthread_t thrds[NTHREADS * 2];
+	struct args args[NTHREADS * 2], *arg;
+	pthread_barrier_t barrier;
+	int ret;
+	int num_cores;
+
+	(void)argc;
+	(void)argv;
+
+	if (check_order() || check_pop_all())
+		return EXIT_FAILURE;
+
+	num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores <= 0)
+		err(EXIT_FAILURE, "sysconf(_SC_NPROCESSORS_ONLN)");
+
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS * 2))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	ret = sheaf_init(&stack, NTHREADS * 2, &pa);
+	if (ret)
+		errx(EXIT_FAILURE, "sheaf_init: %s", strerror(-ret));
+
+	for (i = 0; i < NTHREADS; ++i) {
+		arg = &args[i];
+		args_init(arg, &stack, &barrier, i, num_cores);
+		if (pthread_create(&thrds[i], NULL, push_worker, arg))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	for (i = NTHREADS; i < NTHREADS * 2; ++i) {
+		arg = &args[i];
+		args_init(arg, &stack, &barrier, i, num_cores);
+		if (pthread_create(&thrds[i], NULL, pop_worker, arg))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	for (i = 0; i < NTHREADS * 2; ++i) {
+		if (pthread_join(thrds[i], NULL))
+			warn("pthread_join");
+	}
+
+	sheaf_release(&stack);
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < NTHREADS; ++i)
+		assert(counters[i] == NELEMS);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+/* More threads than the stack has CPUs, so that they keep running into
+ * structures claimed by others */
+#define NCPUS 2UL
+#define NTHREADS 8UL
+#define NELEMS 20000UL
+
+static sheaf_t stack;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+
+static void *worker(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = id * NELEMS + i + 1;
+		if (sheaf_push_cpu(&stack, val))
+			errx(EXIT_FAILURE, "sheaf_push_cpu");
+		atomic_fetch_add(&pushed, val);
+
+		/* Every thread pops at most as many values as it pushed, so
+		 * the stack cannot be empty */
+		if (sheaf_pop_cpu(&stack, &val))
+			errx(EXIT_FAILURE, "sheaf_pop_cpu");
+		sum += val;
+	}
+	atomic_fetch_add(&popped, sum);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NTHREADS];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_push_cpu(NULL, 0) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_push_cpu(NULL)");
+	if (sheaf_pop_cpu(NULL, &val) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pop_cpu(NULL)");
+
+	if (sheaf_init(&stack, NCPUS, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	for (i = 0; i < NTHREADS; ++i) {
+		if (pthread_create(&threads[i], NULL, worker, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NTHREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Every value came out exactly once */
+	if (atomic_load(&pushed) != atomic_load(&popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&pushed),
+			 (unsigned long)atomic_load(&popped));
+	if (sheaf_pop_cpu(&stack, &val) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+/* Enough values to overflow the deferred ring of the producer */
+#define NELEMS (2 * (PAGE_SIZE / sizeof(void *)) * SHEAF_REMOTE_BATCH)
+
+#define PRODUCER 0UL
+#define CONSUMER 1UL
+
+/* Owners of the nodes freed by CPU 0 in check_stages(), more of them than a
+ * handful of shared stages could batch for */
+#define NOWNERS 8UL
+
+static void produce(sheaf_t *stack)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_push(stack, i, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_push");
+	}
+}
+
+static void consume(sheaf_t *stack)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_pop(stack, NULL, CONSUMER))
+			errx(EXIT_FAILURE, "sheaf_pop");
+	}
+}
+
+#ifdef SHEAF_STATS
+
+/* Nodes taken back from the deferred rings, once every owner has looked */
+static uint64_t deferred(sheaf_t *stack)
+{
+	struct sheaf_stats st;
+	size_t i;
+
+	/* Shrinking takes the ring back first */
+	for (i = 1; i <= NOWNERS; ++i)
+		sheaf_shrink(stack, i, SIZE_MAX);
+	if (sheaf_stats_read(stack, &st))
+		errx(EXIT_FAILURE, "sheaf_stats_read");
+
+	return st.deferred;
+}
+
+/* Remote frees to many owners in turn are each batched with the others of the
+ * same owner, rather than sent back early when another owner comes along */
+static void check_stages(void)
+{
+	sheaf_t stack;
+	uint64_t n;
+	size_t i, j;
+
+	if (sheaf_init(&stack, NOWNERS + 1, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	for (i = 0; i < SHEAF_REMOTE_BATCH; ++i) {
+		for (j = 1; j <= NOWNERS; ++j) {
+			if (sheaf_push(&stack, i, j))
+				errx(EXIT_FAILURE, "sheaf_push");
+		}
+	}
+
+	/* All but one node of each owner stay staged */
+	for (i = 0; i < (SHEAF_REMOTE_BATCH - 1) * NOWNERS; ++i) {
+		if (sheaf_pop(&stack, NULL, 0))
+			errx(EXIT_FAILURE, "sheaf_pop");
+	}
+	n = deferred(&stack);
+	if (n)
+		errx(EXIT_FAILURE, "%lu nodes sent back before their batch was full",
+			 (unsigned long)n);
+
+	/* And the last one sends the whole batch */
+	for (i = 0; i < NOWNERS; ++i) {
+		if (sheaf_pop(&stack, NULL, 0))
+			errx(EXIT_FAILURE, "sheaf_pop");
+	}
+	n = deferred(&stack);
+	if (n != NOWNERS * SHEAF_REMOTE_BATCH)
+		errx(EXIT_FAILURE, "%lu nodes sent back, expected %lu",
+			 (unsigned long)n, NOWNERS * SHEAF_REMOTE_BATCH);
+
+	sheaf_release(&stack);
+}
+
+#endif
+
+int main(int argc, const char *argv[])
+{
+	sheaf_t stack;
+	size_t pages;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_init(&stack, 2, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	/* The consumer frees more nodes than the producer's ring can take.
+	 * The rest must be reused by the producer through the depot, rather
+	 * than stay with the consumer while the producer allocates pages */
+	produce(&stack);
+	consume(&stack);
+	pages = pages_used();
+
+	produce(&stack);
+	if (pages_used() != pages) {
+		warnx("producer allocated %lu pages, expected 0",
+			  pages_used() - pages);
+		return EXIT_FAILURE;
+	}
+
+	consume(&stack);
+	sheaf_release(&stack);
+
+	if (pages_used()) {
+		warnx("sheaf_release(): leaked %lu pages", pages_used());
+		return EXIT_FAILURE;
+	}
+
+#ifdef SHEAF_STATS
+	check_stages();
+#endif
+
+	return EXIT_SUCCESS;
+}
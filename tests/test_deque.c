@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "deque.h"
+#include "libtest.h"
+
+#define NTHIEVES 4UL
+#define NCPUS (NTHIEVES + 1)
+#define OWNER 0UL
+
+/* More than fit in the first buffer */
+#define NELEMS (4 * SHEAF_DEQUE_SLOTS_PER_PAGE)
+#define NTASKS 200000UL
+
+static sheaf_deque_t deque;
+static _Atomic uint8_t taken[NTASKS];
+static _Atomic size_t ntaken = 0;
+
+static void take(uintptr_t val)
+{
+	if (val >= NTASKS || atomic_fetch_add(&taken[val], 1))
+		errx(EXIT_FAILURE, "task %lu taken twice", (unsigned long)val);
+	atomic_fetch_add(&ntaken, 1);
+}
+
+static void *thief(void *arg)
+{
+	size_t ncpu = (size_t)arg;
+	uintptr_t val;
+
+	while (atomic_load(&ntaken) < NTASKS) {
+		if (!sheaf_deque_steal(&deque, &val, ncpu))
+			take(val);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NTHIEVES];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_deque_init(NULL, NCPUS, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_deque_init(NULL)");
+	if (sheaf_deque_init(&deque, 0, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_deque_init(0 CPUs)");
+	if (sheaf_deque_init(&deque, NCPUS, NULL) != -SHEAF_ENOMEM)
+		errx(EXIT_FAILURE, "sheaf_deque_init(no allocator)");
+
+	if (sheaf_deque_init(&deque, NCPUS, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_deque_init");
+
+	if (sheaf_deque_push(&deque, 0, NCPUS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_deque_push(bad ncpu)");
+	if (sheaf_deque_pop(&deque, &val, OWNER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_deque_pop on empty deque");
+	if (sheaf_deque_steal(&deque, &val, 1) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_deque_steal on empty deques");
+
+	/* The owner works at the bottom, thieves at the top, and the buffer
+	 * grows as needed */
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_deque_push(&deque, i, OWNER))
+			errx(EXIT_FAILURE, "sheaf_deque_push");
+	}
+	for (i = 0; i < NELEMS / 2; ++i) {
+		if (sheaf_deque_steal(&deque, &val, 1) || val != i)
+			errx(EXIT_FAILURE, "sheaf_deque_steal: expected %zu", i);
+	}
+	for (i = NELEMS; i > NELEMS / 2; --i) {
+		if (sheaf_deque_pop(&deque, &val, OWNER) || val != i - 1)
+			errx(EXIT_FAILURE, "sheaf_deque_pop: expected %zu", i - 1);
+	}
+	if (sheaf_deque_pop(&deque, &val, OWNER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "deque not empty");
+
+	/* Thieves race the owner, which pops half of what it pushes. Every
+	 * task must be taken exactly once */
+	for (i = 0; i < NTHIEVES; ++i) {
+		if (pthread_create(&threads[i], NULL, thief, (void *)(i + 1)))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NTASKS; ++i) {
+		if (sheaf_deque_push(&deque, i, OWNER))
+			errx(EXIT_FAILURE, "sheaf_deque_push");
+		if (i % 2 && !sheaf_deque_pop(&deque, &val, OWNER))
+			take(val);
+	}
+	while (atomic_load(&ntaken) < NTASKS) {
+		if (!sheaf_deque_pop(&deque, &val, OWNER))
+			take(val);
+	}
+	for (i = 0; i < NTHIEVES; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Values left in the deques are dropped on release */
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_deque_push(&deque, i, i % NCPUS))
+			errx(EXIT_FAILURE, "sheaf_deque_push");
+	}
+
+	sheaf_deque_release(&deque);
+
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+/*
+ * Pushers and poppers hammer the same stack, so that failed CAS on the head
+ * send them to the elimination array. Build with SHEAF_ELIM_SLOTS=1 to have
+ * them all meet in the same slot.
+ */
+
+#define NPAIRS 2UL
+#define NTHREADS (2 * NPAIRS)
+#define NELEMS 100000UL
+#define MAX_ROUNDS 20
+
+#define CHECK(cond)                                                         \
+	do {                                                                    \
+		if (!(cond)) {                                                      \
+			warnx("%s:%d: %s", __FILE__, __LINE__, #cond);                  \
+			return EXIT_FAILURE;                                            \
+		}                                                                   \
+	} while (0)
+
+static sheaf_t stack;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+
+static void *pusher(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = id * NELEMS + i + 1;
+		if (sheaf_push(&stack, val, id))
+			errx(EXIT_FAILURE, "sheaf_push");
+		sum += val;
+	}
+	atomic_fetch_add(&pushed, sum);
+
+	return NULL;
+}
+
+static void *popper(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS;) {
+		if (sheaf_pop(&stack, &val, id))
+			continue;
+		sum += val;
+		i++;
+	}
+	atomic_fetch_add(&popped, sum);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NTHREADS];
+	struct sheaf_stats st = { 0 };
+	size_t i, round, nrounds;
+	uintptr_t val;
+
+	(void)argc;
+	(void)argv;
+
+	/* Pairs only meet while running at the same time, which a single CPU
+	 * hardly ever does */
+	nrounds = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MAX_ROUNDS : 1;
+
+	if (sheaf_init(&stack, NTHREADS, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	for (round = 0; round < nrounds; ++round) {
+		for (i = 0; i < NTHREADS; ++i) {
+			if (pthread_create(&threads[i], NULL, i % 2 ? popper : pusher,
+							   (void *)i))
+				err(EXIT_FAILURE, "pthread_create");
+		}
+		for (i = 0; i < NTHREADS; ++i)
+			pthread_join(threads[i], NULL);
+
+		/* Every value came out exactly once, whichever way it went */
+		CHECK(atomic_load(&pushed) == atomic_load(&popped));
+		CHECK(sheaf_pop(&stack, &val, 0) == -SHEAF_EAGAIN);
+
+		if (sheaf_stats_read(&stack, &st))
+			errx(EXIT_FAILURE, "sheaf_stats_read");
+		if (st.elim_pop)
+			break;
+	}
+
+#ifdef SHEAF_STATS
+	/* A pop took the node of each push that found its offer taken, and
+	 * no offer was withdrawn after being taken */
+	CHECK(st.elim_push == st.elim_pop);
+	CHECK(st.push == st.pop);
+#if SHEAF_ELIM_SLOTS > 0
+	if (nrounds > 1)
+		CHECK(st.elim_pop > 0);
+#else
+	CHECK(!st.elim_pop);
+#endif
+#endif
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+/* Enough values to need a few node pages */
+#define NELEMS (NODES_PER_PAGE * 8)
+
+#define ROUNDS 16
+
+/* Push values, then pop them back through the other CPU, checking that every
+ * node is found at the index it was pushed with */
+static int check_round(sheaf_t *stack, size_t round)
+{
+	uintptr_t val;
+	size_t i;
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_push(stack, round * NELEMS + i, 0))
+			errx(EXIT_FAILURE, "sheaf_push");
+	}
+
+	for (i = NELEMS; i > 0; --i) {
+		if (sheaf_pop(stack, &val, 1))
+			errx(EXIT_FAILURE, "sheaf_pop");
+		if (val != round * NELEMS + i - 1) {
+			warnx("round %lu: popped %lu, expected %lu", round, val,
+				  round * NELEMS + i - 1);
+			return 1;
+		}
+	}
+
+	if (sheaf_pop(stack, NULL, 1) != -SHEAF_EAGAIN) {
+		warnx("round %lu: stack not empty", round);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	sheaf_t stack;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+#ifdef SHEAF_INDEX_HEAD
+	/* The whole point of this mode */
+	if (sizeof(sheaf_head_t) != sizeof(uint64_t) ||
+		!atomic_is_lock_free(&stack.head)) {
+		warnx("head is not a lock-free single word");
+		return EXIT_FAILURE;
+	}
+#endif
+
+	if (sheaf_init(&stack, 2, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	/* Give back all the pages between rounds, so that their page numbers
+	 * are handed out again to new pages */
+	for (i = 0; i < ROUNDS; ++i) {
+		if (check_round(&stack, i))
+			return EXIT_FAILURE;
+		percpu_flush_remote(percpu_get(sheaf_dir(&stack), 1));
+		sheaf_push(&stack, 0, 0);
+		sheaf_pop(&stack, NULL, 0);
+		sheaf_shrink(&stack, 0, 0);
+		sheaf_shrink(&stack, 1, 0);
+	}
+
+#ifdef SHEAF_INDEX_HEAD
+	/* Each round needs about as many pages as the first one */
+	if (sheaf_dir(&stack)->pgtbl_next > 2 * (NELEMS / NODES_PER_PAGE + 2)) {
+		warnx("%u page numbers used, they are not reused",
+			  sheaf_dir(&stack)->pgtbl_next);
+		return EXIT_FAILURE;
+	}
+#endif
+
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define SHEAF_NCPUS 4
+#include "libtest.h"
+#include "sheaf_inline.h"
+
+#define NELEMS 100000UL
+
+static sheaf_t stack;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+
+/* Mix the inline and library functions, which share the same stack */
+static void *worker(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+	int ret;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = id * NELEMS + i + 1;
+		if (i % 3 == 0)
+			ret = sheaf_push(&stack, val, id);
+		else
+			ret = sheaf_push_inline(&stack, val, id);
+		if (ret)
+			errx(EXIT_FAILURE, "push: %d", ret);
+		atomic_fetch_add(&pushed, val);
+
+		if (i % 5 == 0)
+			ret = sheaf_pop(&stack, &val, id);
+		else
+			ret = sheaf_pop_inline(&stack, &val, id);
+		if (ret)
+			errx(EXIT_FAILURE, "pop: %d", ret);
+		sum += val;
+	}
+	atomic_fetch_add(&popped, sum);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[SHEAF_NCPUS];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_init(&stack, SHEAF_NCPUS, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	if (sheaf_pop_inline(&stack, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "pop from empty stack");
+
+	/* Run out of the first node page, so that the inline push has to
+	 * take the slow path */
+	for (i = 0; i < 2 * NODES_PER_PAGE; ++i) {
+		if (sheaf_push_inline(&stack, i, 0))
+			errx(EXIT_FAILURE, "sheaf_push_inline");
+	}
+	for (i = 2 * NODES_PER_PAGE; i-- > 0;) {
+		if (sheaf_pop_inline(&stack, &val, 1) || val != i)
+			errx(EXIT_FAILURE, "popped %lu, expected %zu",
+				 (unsigned long)val, i);
+	}
+
+	if (pthread_barrier_init(&barrier, NULL, SHEAF_NCPUS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	for (i = 0; i < SHEAF_NCPUS; ++i) {
+		if (pthread_create(&threads[i], NULL, worker, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < SHEAF_NCPUS; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Every value came out exactly once */
+	if (atomic_load(&pushed) != atomic_load(&popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&pushed),
+			 (unsigned long)atomic_load(&popped));
+	if (sheaf_pop_inline(&stack, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -62,7 +62,8 @@ static int check_pop(sheaf_t *stack, size_t ncpu, int exp, uintptr_t exp_val)
 #define BAD_VAL 0xbadbabeUL
 
 #define NCPUS 8UL
-#define BAD_NCPUS ((PAGE_SIZE / sizeof(percpu_t)) + 1)
+#define MANY_NCPUS 384UL
+#define BAD_NCPUS (SHEAF_MAX_CPUS + 1)
 
 #define CPU 0UL
 #define BAD_CPU NCPUS
@@ -95,6 +96,12 @@ int main(int argc, const char *argv[])
 	if (ret)
 		return EXIT_FAILURE;
 
+	/* More CPUs than fit in a page */
+	ret = check_init(&stack, MANY_NCPUS, &pa, 0);
+	if (ret)
+		return EXIT_FAILURE;
+	sheaf_release(&stack);
+
 	/* Good parameters */
 	ret = check_init(&stack, NCPUS, &pa, 0);
 	if (ret)
@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "libtest.h"
+#include "queue.h"
+#include "sheaf.h"
+
+/*
+ * Signal handlers stand in for interrupt handlers: they push and pop through
+ * the same CPU number as the thread they interrupt, in the middle of its own
+ * pushes and pops. They do the same with a queue, whose dequeues retire
+ * nodes. Without SHEAF_IRQSAFE this would corrupt its freelist, so
+ * there is nothing to test. Neither is there with DEBUG, whose messages are
+ * printed with printf(), which a handler cannot call.
+ */
+#if defined(SHEAF_IRQSAFE) && !defined(DEBUG)
+
+#define NOPS 2000000UL
+#define TIMER_US 20
+
+static sheaf_t stack;
+static sheaf_queue_t queue;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+static _Atomic uint64_t enqueued = 0, dequeued = 0;
+static _Atomic size_t nsignals = 0;
+
+#ifdef SHEAF_SHARED
+
+/* Pages come from the region of pa, whose allocator is lock-free and fine to
+ * call from a handler */
+#define irq_pa pa
+
+#else
+
+/* The handlers may need pages too. malloc() is not async-signal-safe, and
+ * would deadlock if a handler interrupted it, so use mmap() instead */
+static void *irq_alloc_page(void *opaque)
+{
+	void *page;
+
+	(void)opaque;
+	page = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return page == MAP_FAILED ? NULL : page;
+}
+
+static void irq_free_page(void *opaque, void *page)
+{
+	(void)opaque;
+	munmap(page, PAGE_SIZE);
+}
+
+static pa_t irq_pa = {
+	.alloc_page = irq_alloc_page,
+	.free_page = irq_free_page,
+};
+
+#endif
+
+static _Atomic int failed = 0, done = 0;
+
+/* Either push or pop, so that the freelist of the interrupted CPU is not the
+ * same once the handler returns */
+static void handler(int sig)
+{
+	size_t n = atomic_fetch_add(&nsignals, 1);
+	uintptr_t val = NOPS + n;
+
+	(void)sig;
+
+	if (n % 2) {
+		if (!sheaf_pop(&stack, &val, 0))
+			atomic_fetch_add(&popped, val);
+		if (!sheaf_dequeue(&queue, &val, 0))
+			atomic_fetch_add(&dequeued, val);
+		return;
+	}
+
+	if (sheaf_push(&stack, val, 0) || sheaf_enqueue(&queue, val, 0)) {
+		atomic_store(&failed, 1);
+		return;
+	}
+	atomic_fetch_add(&pushed, val);
+	atomic_fetch_add(&enqueued, val);
+}
+
+/* Interrupted by the timer */
+static void *worker(void *arg)
+{
+	uintptr_t val;
+	sigset_t set;
+	size_t i;
+
+	(void)arg;
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NOPS; ++i) {
+		if (sheaf_push(&stack, i, 0))
+			errx(EXIT_FAILURE, "sheaf_push");
+		atomic_fetch_add(&pushed, i);
+		if (!sheaf_pop(&stack, &val, 0))
+			atomic_fetch_add(&popped, val);
+
+		if (sheaf_enqueue(&queue, i, 0))
+			errx(EXIT_FAILURE, "sheaf_enqueue");
+		atomic_fetch_add(&enqueued, i);
+		if (!sheaf_dequeue(&queue, &val, 0))
+			atomic_fetch_add(&dequeued, val);
+	}
+	atomic_store(&done, 1);
+
+	return NULL;
+}
+
+/* Frees nodes of the worker from another CPU, so that they go through its
+ * deferred ring */
+static void *remote(void *arg)
+{
+	uintptr_t val;
+
+	(void)arg;
+	barrier_wait(&barrier);
+
+	while (!atomic_load(&done)) {
+		if (!sheaf_pop(&stack, &val, 1))
+			atomic_fetch_add(&popped, val);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct itimerval timer = {
+		.it_interval = { .tv_usec = TIMER_US },
+		.it_value = { .tv_usec = TIMER_US },
+	};
+	struct sigaction sa = { .sa_handler = handler };
+	pthread_t threads[2];
+	uintptr_t val;
+	sigset_t set;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_init(&stack, 2, &irq_pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+	if (sheaf_queue_init(&queue, 2, &irq_pa))
+		errx(EXIT_FAILURE, "sheaf_queue_init");
+
+	/* Only the worker takes the signal */
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGALRM, &sa, NULL))
+		err(EXIT_FAILURE, "sigaction");
+
+	if (pthread_barrier_init(&barrier, NULL, 3))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+	if (pthread_create(&threads[0], NULL, worker, NULL) ||
+		pthread_create(&threads[1], NULL, remote, NULL))
+		err(EXIT_FAILURE, "pthread_create");
+
+	if (setitimer(ITIMER_REAL, &timer, NULL))
+		err(EXIT_FAILURE, "setitimer");
+	barrier_wait(&barrier);
+
+	pthread_join(threads[0], NULL);
+	timer.it_value.tv_usec = 0;
+	if (setitimer(ITIMER_REAL, &timer, NULL))
+		err(EXIT_FAILURE, "setitimer");
+	pthread_join(threads[1], NULL);
+
+	if (atomic_load(&failed))
+		errx(EXIT_FAILURE, "push failed in the signal handler");
+	if (!atomic_load(&nsignals))
+		errx(EXIT_FAILURE, "no signal was handled");
+
+	while (!sheaf_pop(&stack, &val, 1))
+		atomic_fetch_add(&popped, val);
+
+	/* Every value came out exactly once */
+	if (atomic_load(&pushed) != atomic_load(&popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&pushed),
+			 (unsigned long)atomic_load(&popped));
+
+	while (!sheaf_dequeue(&queue, &val, 1))
+		atomic_fetch_add(&dequeued, val);
+	if (atomic_load(&enqueued) != atomic_load(&dequeued))
+		errx(EXIT_FAILURE, "enqueued %lu, dequeued %lu",
+			 (unsigned long)atomic_load(&enqueued),
+			 (unsigned long)atomic_load(&dequeued));
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_queue_release(&queue);
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int main(int argc, const char *argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	return EXIT_SUCCESS;
+}
+
+#endif
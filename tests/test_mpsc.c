@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "mpsc.h"
+
+#define NPRODUCERS 4UL
+#define CONSUMER NPRODUCERS
+#define NELEMS 50000UL
+
+static sheaf_mpsc_t stack;
+static pthread_barrier_t barrier;
+static unsigned char seen[NPRODUCERS * NELEMS];
+static size_t consumed = 0;
+
+static void *producer(void *arg)
+{
+	size_t id = (size_t)arg, i;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_mpsc_push(&stack, id * NELEMS + i, id))
+			errx(EXIT_FAILURE, "sheaf_mpsc_push");
+	}
+
+	return NULL;
+}
+
+static void consume(uintptr_t val, void *opaque)
+{
+	(void)opaque;
+
+	if (val >= NPRODUCERS * NELEMS || seen[val]++)
+		errx(EXIT_FAILURE, "value %lu popped twice", (unsigned long)val);
+	consumed++;
+}
+
+static void *consumer(void *arg)
+{
+	uintptr_t val;
+	size_t i = 0;
+
+	(void)arg;
+	barrier_wait(&barrier);
+
+	/* Alternate between draining everything and popping one at a time */
+	while (consumed < NPRODUCERS * NELEMS) {
+		if (i++ % 2) {
+			sheaf_mpsc_pop_all(&stack, consume, NULL, CONSUMER);
+			continue;
+		}
+		if (!sheaf_mpsc_pop(&stack, &val, CONSUMER))
+			consume(val, NULL);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NPRODUCERS + 1];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_mpsc_init(NULL, 1, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_mpsc_init(NULL)");
+	if (sheaf_mpsc_init(&stack, NPRODUCERS + 1, &pa))
+		errx(EXIT_FAILURE, "sheaf_mpsc_init");
+	if (sheaf_mpsc_pop(&stack, &val, CONSUMER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "pop from empty stack");
+	if (sheaf_mpsc_push(&stack, 0, NPRODUCERS + 1) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_mpsc_push(bad ncpu)");
+
+	/* Values come out last in, first out */
+	for (i = 0; i < 3; ++i) {
+		if (sheaf_mpsc_push(&stack, i, 0))
+			errx(EXIT_FAILURE, "sheaf_mpsc_push");
+	}
+	for (i = 3; i-- > 0;) {
+		if (sheaf_mpsc_pop(&stack, &val, CONSUMER) || val != i)
+			errx(EXIT_FAILURE, "popped %lu, expected %zu",
+				 (unsigned long)val, i);
+	}
+
+	if (pthread_barrier_init(&barrier, NULL, NPRODUCERS + 1))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	for (i = 0; i < NPRODUCERS; ++i) {
+		if (pthread_create(&threads[i], NULL, producer, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	if (pthread_create(&threads[i], NULL, consumer, NULL))
+		err(EXIT_FAILURE, "pthread_create");
+	for (i = 0; i < NPRODUCERS + 1; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (sheaf_mpsc_pop_all(&stack, NULL, NULL, CONSUMER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_mpsc_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "multi.h"
+
+#define NLANES 4UL
+#define NTHREADS 8UL
+#define NELEMS 20000UL
+
+static sheaf_multi_t stack;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+
+static void *worker(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = id * NELEMS + i + 1;
+		if (sheaf_multi_push(&stack, val, id))
+			errx(EXIT_FAILURE, "sheaf_multi_push");
+		atomic_fetch_add(&pushed, val);
+
+		/* Some other thread may have taken our value, and its own may
+		 * still be on its way */
+		while (sheaf_multi_pop(&stack, &val, id))
+			;
+		sum += val;
+	}
+	atomic_fetch_add(&popped, sum);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NTHREADS];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_multi_init(NULL, NLANES, NTHREADS, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_multi_init(NULL)");
+	if (sheaf_multi_init(&stack, 0, NTHREADS, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_multi_init(0 lanes)");
+	if (sheaf_multi_init(&stack, SHEAF_MULTI_MAX_LANES + 1, NTHREADS, &pa) !=
+		-SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_multi_init(too many lanes)");
+	if (sheaf_multi_init(&stack, NLANES, NTHREADS, NULL) != -SHEAF_ENOMEM)
+		errx(EXIT_FAILURE, "sheaf_multi_init(no allocator)");
+
+	if (sheaf_multi_init(&stack, NLANES, NTHREADS, &pa))
+		errx(EXIT_FAILURE, "sheaf_multi_init");
+
+	if (sheaf_multi_push(&stack, 0, NTHREADS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_multi_push(bad ncpu)");
+	if (sheaf_multi_pop(&stack, &val, NTHREADS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_multi_pop(bad ncpu)");
+
+	/* Each lane is LIFO */
+	for (i = 1; i <= 3; ++i) {
+		if (sheaf_multi_push(&stack, i, 0))
+			errx(EXIT_FAILURE, "sheaf_multi_push");
+	}
+	for (i = 3; i >= 1; --i) {
+		if (sheaf_multi_pop(&stack, &val, 0) || val != i)
+			errx(EXIT_FAILURE, "sheaf_multi_pop from own lane");
+	}
+
+	/* Values in other lanes are stolen once ours is empty */
+	if (sheaf_multi_push(&stack, 42, 1) || sheaf_multi_push(&stack, 43, 2))
+		errx(EXIT_FAILURE, "sheaf_multi_push");
+	if (sheaf_multi_pop(&stack, &val, 2) || val != 43)
+		errx(EXIT_FAILURE, "sheaf_multi_pop from own lane");
+	if (sheaf_multi_pop(&stack, &val, 2) || val != 42)
+		errx(EXIT_FAILURE, "sheaf_multi_pop from another lane");
+	if (sheaf_multi_pop(&stack, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_multi_pop on empty stack");
+
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+	for (i = 0; i < NTHREADS; ++i) {
+		if (pthread_create(&threads[i], NULL, worker, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NTHREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Every value came out exactly once */
+	if (atomic_load(&pushed) != atomic_load(&popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&pushed),
+			 (unsigned long)atomic_load(&popped));
+	if (sheaf_multi_pop(&stack, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	/* Values left in the lanes are given back on release */
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_multi_push(&stack, i, i % NTHREADS))
+			errx(EXIT_FAILURE, "sheaf_multi_push");
+	}
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_multi_release(&stack);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtest.h"
+#include "pool.h"
+
+#define PRODUCER 0UL
+#define CONSUMER 1UL
+#define THIEF 2UL
+
+#define NOBJS 1000UL
+#define NROUNDS 200UL
+
+static void *objs[NOBJS];
+
+/* Allocate objects of the given size, and check that they do not overlap by
+ * filling each with its own pattern */
+static void check_size(size_t size)
+{
+	sheaf_pool_t pool;
+	size_t i, j;
+
+	if (sheaf_pool_init(&pool, size, 2, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_pool_init(%zu)", size);
+
+	for (i = 0; i < NOBJS; ++i) {
+		if (sheaf_pool_alloc(&pool, &objs[i], PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_pool_alloc(%zu)", size);
+		if ((uintptr_t)objs[i] % 16)
+			errx(EXIT_FAILURE, "object %p not aligned", objs[i]);
+		memset(objs[i], (int)(i & 0xff), size);
+	}
+	for (i = 0; i < NOBJS; ++i) {
+		for (j = 0; j < size; ++j) {
+			if (((unsigned char *)objs[i])[j] != (i & 0xff))
+				errx(EXIT_FAILURE, "objects of size %zu overlap", size);
+		}
+	}
+
+	/* Objects freed by another CPU go back to their owner */
+	for (i = 0; i < NOBJS; ++i) {
+		if (sheaf_pool_free(&pool, objs[i], CONSUMER))
+			errx(EXIT_FAILURE, "sheaf_pool_free");
+	}
+
+	sheaf_pool_release(&pool);
+}
+
+static sheaf_pool_t pool;
+static pthread_barrier_t barrier;
+static _Atomic int stop = 0;
+
+/* More objects than the owner's ring holds batches of, so that the rest goes
+ * through the depot */
+#define NSPILL ((PAGE_SIZE / sizeof(sheaf_ring_t) + 64) * SHEAF_REMOTE_BATCH)
+
+static void *spilled[NSPILL];
+
+/* Takes chains from the depot while the owner of their objects shrinks */
+static void *thief(void *arg)
+{
+	void *mine[64];
+	int n;
+
+	(void)arg;
+	while (!atomic_load(&stop)) {
+		n = sheaf_pool_alloc_bulk(&pool, mine, 64, THIEF);
+		if (n < 0)
+			errx(EXIT_FAILURE, "sheaf_pool_alloc_bulk: %d", n);
+		if (sheaf_pool_free_bulk(&pool, mine, (size_t)n, THIEF))
+			errx(EXIT_FAILURE, "sheaf_pool_free_bulk");
+	}
+
+	return NULL;
+}
+
+/* Shrink the owner while another CPU takes chains of its objects from the
+ * depot. Those chains are read through a possibly stale top, so their pages
+ * may only be given back once nobody can be reading them anymore */
+static void check_shrink_depot(void)
+{
+#ifdef SHEAF_STATS
+	struct sheaf_stats st;
+#endif
+	pthread_t thread;
+	size_t i, j;
+	int ret;
+
+	if (sheaf_pool_init(&pool, 64, 3, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_pool_init");
+	if (pthread_create(&thread, NULL, thief, NULL))
+		err(EXIT_FAILURE, "pthread_create");
+
+	for (i = 0; i < 8; ++i) {
+		for (j = 0; j < NSPILL; ++j) {
+			if (sheaf_pool_alloc(&pool, &spilled[j], PRODUCER))
+				errx(EXIT_FAILURE, "sheaf_pool_alloc");
+		}
+		ret = sheaf_pool_free_bulk(&pool, spilled, NSPILL, CONSUMER);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_pool_free_bulk: %d", ret);
+
+		/* Take back what we can, leaving chains in the depot for
+		 * the thief */
+		for (j = 0; j < NSPILL / 2; ++j) {
+			if (sheaf_pool_alloc(&pool, &spilled[j], PRODUCER))
+				errx(EXIT_FAILURE, "sheaf_pool_alloc");
+		}
+		ret = sheaf_pool_free_bulk(&pool, spilled, NSPILL / 2, PRODUCER);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_pool_free_bulk: %d", ret);
+		ret = sheaf_pool_shrink(&pool, PRODUCER, 0);
+		if (ret < 0)
+			errx(EXIT_FAILURE, "sheaf_pool_shrink: %d", ret);
+	}
+
+	atomic_store(&stop, 1);
+	pthread_join(thread, NULL);
+
+#ifdef SHEAF_STATS
+	percpu_stats_read(pool.percpu, &st);
+	if (!st.ring_full)
+		errx(EXIT_FAILURE, "the depot was never used");
+#endif
+
+	sheaf_pool_release(&pool);
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+}
+
+/* The consumer frees every object the producer allocates */
+static void *consumer(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+	for (i = 0; i < NROUNDS; ++i) {
+		barrier_wait(&barrier);
+		if (sheaf_pool_free_bulk(&pool, objs, NOBJS, CONSUMER))
+			errx(EXIT_FAILURE, "sheaf_pool_free_bulk");
+		barrier_wait(&barrier);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t i, pages, sizes[] = { 1, 16, 24, 100, 1000, 2040,
+								 SHEAF_POOL_MAX_SIZE };
+	pthread_t thread;
+	void *obj;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_pool_init(NULL, 16, 2, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_init(NULL)");
+	if (sheaf_pool_init(&pool, 0, 2, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_init(size 0)");
+	if (sheaf_pool_init(&pool, SHEAF_POOL_MAX_SIZE + 1, 2, &pa) !=
+		-SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_init(too large)");
+	if (sheaf_pool_init(&pool, 16, 2, NULL) != -SHEAF_ENOMEM)
+		errx(EXIT_FAILURE, "sheaf_pool_init(no allocator)");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+		check_size(sizes[i]);
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+
+	check_shrink_depot();
+
+	if (sheaf_pool_init(&pool, 64, 2, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_pool_init");
+
+	if (sheaf_pool_alloc(&pool, &obj, 2) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_alloc(bad ncpu)");
+	if (sheaf_pool_alloc(&pool, NULL, PRODUCER) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_alloc(NULL)");
+	if (sheaf_pool_free(&pool, NULL, PRODUCER) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pool_free(NULL)");
+
+	/* Objects keep going around between the two CPUs without the pool
+	 * growing every round */
+	if (pthread_barrier_init(&barrier, NULL, 2))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+	if (pthread_create(&thread, NULL, consumer, NULL))
+		err(EXIT_FAILURE, "pthread_create");
+
+	pages = 0;
+	for (i = 0; i < NROUNDS; ++i) {
+		ret = sheaf_pool_alloc_bulk(&pool, objs, NOBJS, PRODUCER);
+		if (ret != (int)NOBJS)
+			errx(EXIT_FAILURE, "sheaf_pool_alloc_bulk: %d", ret);
+		if (i == NROUNDS / 2)
+			pages = pages_used();
+		barrier_wait(&barrier);
+		barrier_wait(&barrier);
+	}
+	pthread_join(thread, NULL);
+
+	if (pages_used() > pages)
+		errx(EXIT_FAILURE, "pool grew from %zu to %zu pages", pages,
+			 pages_used());
+
+	/* Once every object is back, all but the kept pages can be given
+	 * back */
+	if (sheaf_pool_alloc(&pool, &obj, PRODUCER))
+		errx(EXIT_FAILURE, "sheaf_pool_alloc");
+	if (sheaf_pool_free(&pool, obj, PRODUCER))
+		errx(EXIT_FAILURE, "sheaf_pool_free");
+	ret = sheaf_pool_shrink(&pool, PRODUCER, 0);
+	if (ret <= 0)
+		errx(EXIT_FAILURE, "sheaf_pool_shrink: %d", ret);
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_pool_release(&pool);
+
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libtest.h"
+#include "park.h"
+#include "sheaf.h"
+
+#define NCONSUMERS 4UL
+#define NELEMS 1000UL
+
+#define PRODUCER 0UL
+
+/* Long enough for the consumers to be asleep by then */
+#define SLEEP_NS 20000000UL
+#define TIMEOUT_NS 10000000UL
+
+static sheaf_t stack;
+
+static void *consumer(void *arg)
+{
+	size_t ncpu = (size_t)arg, i;
+	uintptr_t val;
+	int ret;
+
+	for (i = 0; i < NELEMS; ++i) {
+		ret = sheaf_pop_wait(&stack, &val, ncpu, SHEAF_WAIT_FOREVER);
+		if (ret)
+			errx(EXIT_FAILURE, "sheaf_pop_wait: %d", ret);
+	}
+
+	return NULL;
+}
+
+static void sleep_ns(unsigned long ns)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = (long)ns };
+
+	nanosleep(&ts, NULL);
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NCONSUMERS];
+	uint64_t start, elapsed;
+	uintptr_t val;
+	size_t i;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_init(&stack, NCONSUMERS + 1, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	if (sheaf_pop_wait(NULL, &val, PRODUCER, 0) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pop_wait(NULL)");
+	if (sheaf_pop_wait(&stack, &val, NCONSUMERS + 1, 0) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_pop_wait(bad ncpu)");
+
+	/* Nothing is pushed, so the whole timeout goes by */
+	start = __sheaf_clock_ns();
+	ret = sheaf_pop_wait(&stack, &val, PRODUCER, TIMEOUT_NS);
+	elapsed = __sheaf_clock_ns() - start;
+	if (ret != -SHEAF_ETIMEDOUT)
+		errx(EXIT_FAILURE, "sheaf_pop_wait on empty stack: %d", ret);
+	if (elapsed < TIMEOUT_NS)
+		errx(EXIT_FAILURE, "sheaf_pop_wait timed out after %lu ns",
+			 (unsigned long)elapsed);
+
+	/* A value already there is returned right away */
+	if (sheaf_push(&stack, 42, PRODUCER))
+		errx(EXIT_FAILURE, "sheaf_push");
+	if (sheaf_pop_wait(&stack, &val, PRODUCER, 0) || val != 42)
+		errx(EXIT_FAILURE, "sheaf_pop_wait on non-empty stack");
+
+	/* Consumers go to sleep on the empty stack, and every push and bulk
+	 * push must wake one of them up */
+	for (i = 0; i < NCONSUMERS; ++i) {
+		if (pthread_create(&threads[i], NULL, consumer, (void *)(i + 1)))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	sleep_ns(SLEEP_NS);
+
+	for (i = 0; i < NCONSUMERS * NELEMS / 2; ++i) {
+		if (sheaf_push(&stack, i, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_push");
+		if (i % 64 == 0)
+			sleep_ns(SLEEP_NS / 64);
+	}
+	sleep_ns(SLEEP_NS);
+	for (i = 0; i < NCONSUMERS * NELEMS / 2; i += 8) {
+		uintptr_t vals[8] = { 0 };
+
+		if (sheaf_push_bulk(&stack, vals, 8, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_push_bulk");
+	}
+
+	for (i = 0; i < NCONSUMERS; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (sheaf_pop(&stack, &val, PRODUCER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}
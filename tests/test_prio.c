@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "prio.h"
+
+#define NLEVELS 8UL
+#define NTHREADS 8UL
+#define NELEMS 20000UL
+
+static sheaf_prio_t stack;
+static pthread_barrier_t barrier;
+static _Atomic uint64_t pushed = 0, popped = 0;
+
+static void *worker(void *arg)
+{
+	size_t id = (size_t)arg, i;
+	uint64_t sum = 0;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = id * NELEMS + i + 1;
+		if (sheaf_prio_push(&stack, val, val % NLEVELS, id))
+			errx(EXIT_FAILURE, "sheaf_prio_push");
+		atomic_fetch_add(&pushed, val);
+
+		/* Leave a value behind now and then, so that levels go from
+		 * empty to not empty and back while others look at them */
+		if (i % 3 == 0)
+			continue;
+		if (!sheaf_prio_pop(&stack, &val, NULL, id))
+			sum += val;
+	}
+	atomic_fetch_add(&popped, sum);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NTHREADS];
+	uintptr_t val;
+	size_t i, level;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_prio_init(NULL, NLEVELS, NTHREADS, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_init(NULL)");
+	if (sheaf_prio_init(&stack, 0, NTHREADS, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_init(0 levels)");
+	if (sheaf_prio_init(&stack, SHEAF_PRIO_MAX_LEVELS + 1, NTHREADS, &pa) !=
+		-SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_init(too many levels)");
+	if (sheaf_prio_init(&stack, NLEVELS, NTHREADS, NULL) != -SHEAF_ENOMEM)
+		errx(EXIT_FAILURE, "sheaf_prio_init(no allocator)");
+
+	if (sheaf_prio_init(&stack, NLEVELS, NTHREADS, &pa))
+		errx(EXIT_FAILURE, "sheaf_prio_init");
+
+	if (sheaf_prio_push(&stack, 0, 0, NTHREADS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_push(bad ncpu)");
+	if (sheaf_prio_push(&stack, 0, NLEVELS, 0) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_push(bad level)");
+	if (sheaf_prio_pop(&stack, &val, NULL, NTHREADS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_prio_pop(bad ncpu)");
+	if (sheaf_prio_pop(&stack, &val, NULL, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_prio_pop on empty stack");
+
+	/* Higher levels come out first, each of them LIFO */
+	for (i = 0; i < 2 * NLEVELS; ++i) {
+		if (sheaf_prio_push(&stack, i, i % NLEVELS, i % NTHREADS))
+			errx(EXIT_FAILURE, "sheaf_prio_push");
+	}
+	for (i = 2 * NLEVELS; i-- > 0;) {
+		/* Each level holds i + NLEVELS on top of i */
+		if (sheaf_prio_pop(&stack, &val, &level, 0) ||
+			level != i / 2 || val != level + (i % 2) * NLEVELS)
+			errx(EXIT_FAILURE, "sheaf_prio_pop: %lu at level %lu",
+				 (unsigned long)val, (unsigned long)level);
+	}
+	if (sheaf_prio_pop(&stack, &val, NULL, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+	for (i = 0; i < NTHREADS; ++i) {
+		if (pthread_create(&threads[i], NULL, worker, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NTHREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* No level was left behind with its bit cleared, so that every value
+	 * comes out exactly once, highest levels first */
+	level = NLEVELS;
+	while (!sheaf_prio_pop(&stack, &val, &i, 0)) {
+		if (i > level || i != val % NLEVELS)
+			errx(EXIT_FAILURE, "sheaf_prio_pop: level %lu after %lu",
+				 (unsigned long)i, (unsigned long)level);
+		level = i;
+		atomic_fetch_add(&popped, val);
+	}
+	if (atomic_load(&pushed) != atomic_load(&popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&pushed),
+			 (unsigned long)atomic_load(&popped));
+	if (atomic_load(&stack.nonempty))
+		errx(EXIT_FAILURE, "empty stack with levels marked");
+
+	/* Values left in the levels are given back on release */
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_prio_push(&stack, i, i % NLEVELS, i % NTHREADS))
+			errx(EXIT_FAILURE, "sheaf_prio_push");
+	}
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_prio_release(&stack);
+
+	return EXIT_SUCCESS;
+}
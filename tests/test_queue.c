@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "queue.h"
+
+#define NPRODUCERS 4UL
+#define NCONSUMERS 4UL
+#define NELEMS 50000UL
+
+/* Values carry their producer in the top bits and a sequence number below */
+#define VAL(id, seq) (((uintptr_t)(id) << 32) | (seq))
+#define VAL_ID(val) ((val) >> 32)
+#define VAL_SEQ(val) ((val) & 0xffffffffUL)
+
+static sheaf_queue_t queue;
+static pthread_barrier_t barrier;
+static _Atomic size_t consumed = 0;
+
+static void *producer(void *arg)
+{
+	size_t id = (size_t)arg, i;
+
+	barrier_wait(&barrier);
+
+	for (i = 1; i <= NELEMS; ++i) {
+		if (sheaf_enqueue(&queue, VAL(id, i), id))
+			errx(EXIT_FAILURE, "sheaf_enqueue");
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	size_t ncpu = NPRODUCERS + (size_t)arg;
+	uintptr_t last[NPRODUCERS] = { 0 }, val;
+
+	barrier_wait(&barrier);
+
+	while (atomic_load(&consumed) < NPRODUCERS * NELEMS) {
+		if (sheaf_dequeue(&queue, &val, ncpu))
+			continue;
+		atomic_fetch_add(&consumed, 1);
+
+		/* Values of each producer come out in the order they went in */
+		if (VAL_ID(val) >= NPRODUCERS || VAL_SEQ(val) <= last[VAL_ID(val)])
+			errx(EXIT_FAILURE, "value %#lx out of order",
+				 (unsigned long)val);
+		last[VAL_ID(val)] = VAL_SEQ(val);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NPRODUCERS + NCONSUMERS];
+	size_t i, pages;
+	uintptr_t val;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_queue_init(NULL, 1, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_queue_init(NULL)");
+	if (sheaf_queue_init(&queue, 0, &pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_queue_init(0 CPUs)");
+	if (sheaf_queue_init(&queue, 1, NULL) != -SHEAF_ENOMEM)
+		errx(EXIT_FAILURE, "sheaf_queue_init(no allocator)");
+
+	if (sheaf_queue_init(&queue, NPRODUCERS + NCONSUMERS, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_queue_init");
+
+	if (sheaf_enqueue(&queue, 0, NPRODUCERS + NCONSUMERS) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_enqueue(bad ncpu)");
+	if (sheaf_dequeue(&queue, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_dequeue on empty queue");
+
+	/* First in, first out */
+	for (i = 0; i < 100; ++i) {
+		if (sheaf_enqueue(&queue, i, i % 2))
+			errx(EXIT_FAILURE, "sheaf_enqueue");
+	}
+	for (i = 0; i < 100; ++i) {
+		if (sheaf_dequeue(&queue, &val, 2) || val != i)
+			errx(EXIT_FAILURE, "sheaf_dequeue: expected %zu", i);
+	}
+
+	/* Retired nodes are reused rather than piling up */
+	pages = pages_used();
+	for (i = 0; i < 100 * NODES_PER_PAGE; ++i) {
+		if (sheaf_enqueue(&queue, i, 0) || sheaf_dequeue(&queue, &val, 0))
+			errx(EXIT_FAILURE, "enqueue/dequeue");
+	}
+	if (pages_used() > pages + 1)
+		errx(EXIT_FAILURE, "%zu pages in use, expected at most %zu",
+			 pages_used(), pages + 1);
+
+	if (pthread_barrier_init(&barrier, NULL, NPRODUCERS + NCONSUMERS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+	for (i = 0; i < NPRODUCERS; ++i) {
+		if (pthread_create(&threads[i], NULL, producer, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NCONSUMERS; ++i) {
+		if (pthread_create(&threads[NPRODUCERS + i], NULL, consumer,
+						   (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NPRODUCERS + NCONSUMERS; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (atomic_load(&consumed) != NPRODUCERS * NELEMS)
+		errx(EXIT_FAILURE, "consumed %zu values", atomic_load(&consumed));
+	if (sheaf_dequeue(&queue, &val, 0) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "queue not empty");
+
+	/* Values left in the queue are given back on release */
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_enqueue(&queue, i, i % NPRODUCERS))
+			errx(EXIT_FAILURE, "sheaf_enqueue");
+	}
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_queue_release(&queue);
+
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+
+	return EXIT_SUCCESS;
+}
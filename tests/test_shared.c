@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "region.h"
+#include "sheaf.h"
+
+/*
+ * Processes push to and pop from a stack in a shared region, each with the
+ * region mapped at its own address. Without SHEAF_SHARED the stack holds
+ * plain pointers, so there is nothing to test.
+ */
+#ifdef SHEAF_SHARED
+
+#define NCHILDREN 3UL
+#define NCPUS (NCHILDREN + 1)
+#define NELEMS 50000UL
+#define REGION_SIZE (1024UL * PAGE_SIZE)
+#define WAIT_NS 5000000000ULL
+
+/* Root of the region, in a page of its own */
+struct shared {
+	sheaf_t stack;
+	_Atomic uint64_t pushed;
+	_Atomic uint64_t popped;
+};
+
+static int fd;
+
+/* A page allocator only this process can call */
+static void *heap_alloc_page(void *opaque)
+{
+	void *page = NULL;
+
+	(void)opaque;
+	if (posix_memalign(&page, PAGE_SIZE, PAGE_SIZE))
+		return NULL;
+
+	return page;
+}
+
+static void heap_free_page(void *opaque, void *page)
+{
+	(void)opaque;
+	free(page);
+}
+
+static pa_t heap_pa = {
+	.alloc_page = heap_alloc_page,
+	.free_page = heap_free_page,
+};
+
+/* Map the region again, away from the mapping inherited from the parent,
+ * which is then dropped so that no address of the parent can be used */
+static void *remap(void *old)
+{
+	void *base;
+
+	base = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+	if (base == old)
+		errx(EXIT_FAILURE, "region mapped at the same address");
+	munmap(old, REGION_SIZE);
+
+	if (sheaf_region_attach(base, REGION_SIZE))
+		errx(EXIT_FAILURE, "sheaf_region_attach");
+
+	return base;
+}
+
+static void child(void *old, size_t ncpu)
+{
+	struct shared *sh = sheaf_region_root(remap(old));
+	uint64_t sum = 0;
+	uintptr_t val;
+	size_t i;
+
+	if (!sh)
+		errx(EXIT_FAILURE, "no root");
+
+	for (i = 0; i < NELEMS; ++i) {
+		val = ncpu * NELEMS + i + 1;
+		if (sheaf_push(&sh->stack, val, ncpu))
+			errx(EXIT_FAILURE, "sheaf_push");
+		atomic_fetch_add(&sh->pushed, val);
+
+		/* Every process pops at most as many values as it pushed, so
+		 * the stack cannot be empty */
+		if (sheaf_pop(&sh->stack, &val, ncpu))
+			errx(EXIT_FAILURE, "sheaf_pop");
+		sum += val;
+	}
+	atomic_fetch_add(&sh->popped, sum);
+
+	exit(EXIT_SUCCESS);
+}
+
+/* Sleep in another process until the parent pushes a value */
+static void waiter(void *old)
+{
+	struct shared *sh = sheaf_region_root(remap(old));
+	uint64_t start = __sheaf_clock_ns();
+	uintptr_t val;
+
+	if (sheaf_pop_wait(&sh->stack, &val, 1, WAIT_NS) || val != 42)
+		exit(EXIT_FAILURE);
+
+	/* The value is there once the wait times out too */
+	if (__sheaf_clock_ns() - start >= WAIT_NS)
+		exit(EXIT_FAILURE);
+
+	exit(EXIT_SUCCESS);
+}
+
+static void wait_children(size_t n)
+{
+	int status;
+
+	while (n--) {
+		if (wait(&status) < 0)
+			err(EXIT_FAILURE, "wait");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			errx(EXIT_FAILURE, "child failed");
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	struct shared *sh;
+	uintptr_t val;
+	void *base;
+	pid_t pid;
+	pa_t pa;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	fd = memfd_create("sheaf", 0);
+	if (fd < 0)
+		err(EXIT_FAILURE, "memfd_create");
+	if (ftruncate(fd, REGION_SIZE))
+		err(EXIT_FAILURE, "ftruncate");
+	base = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+
+	if (sheaf_region_attach(base, REGION_SIZE) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "attached to an uninitialized region");
+	if (sheaf_region_init(base, REGION_SIZE))
+		errx(EXIT_FAILURE, "sheaf_region_init");
+	sheaf_region_pa(base, &pa);
+
+	sh = sheaf_region_alloc_page(base);
+	if (!sh)
+		errx(EXIT_FAILURE, "sheaf_region_alloc_page");
+	/* Other processes could not get pages from heap_pa */
+	if (sheaf_init(&sh->stack, NCPUS, &heap_pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_init accepted pages outside the region");
+	if (sheaf_init(&sh->stack, NCPUS, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+	atomic_init(&sh->pushed, 0);
+	atomic_init(&sh->popped, 0);
+	sheaf_region_set_root(base, sh);
+
+	for (i = 1; i <= NCHILDREN; ++i) {
+		pid = fork();
+		if (pid < 0)
+			err(EXIT_FAILURE, "fork");
+		if (!pid)
+			child(base, i);
+	}
+	wait_children(NCHILDREN);
+
+	/* Every value came out exactly once */
+	while (!sheaf_pop(&sh->stack, &val, 0))
+		atomic_fetch_add(&sh->popped, val);
+	if (atomic_load(&sh->pushed) != atomic_load(&sh->popped))
+		errx(EXIT_FAILURE, "pushed %lu, popped %lu",
+			 (unsigned long)atomic_load(&sh->pushed),
+			 (unsigned long)atomic_load(&sh->popped));
+
+	/* Wake-ups reach sleepers in other processes */
+	pid = fork();
+	if (pid < 0)
+		err(EXIT_FAILURE, "fork");
+	if (!pid)
+		waiter(base);
+	usleep(100000);
+	if (sheaf_push(&sh->stack, 42, 0))
+		errx(EXIT_FAILURE, "sheaf_push");
+	wait_children(1);
+
+	/* Pages go back to the region */
+	sheaf_release(&sh->stack);
+	sheaf_region_free_page(base, sh);
+	if (sheaf_region_alloc_page(base) != (void *)sh)
+		errx(EXIT_FAILURE, "page not reused");
+
+	munmap(base, REGION_SIZE);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int main(int argc, const char *argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	return EXIT_SUCCESS;
+}
+
+#endif
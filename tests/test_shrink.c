@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+#ifndef NTHREADS
+#define NTHREADS 8UL
+#endif
+
+#ifndef NELEMS
+#define NELEMS 0x2000UL
+#endif
+
+/* Push enough values to need many node pages */
+#define SPIKE (NODES_PER_PAGE * 64)
+
+static int check_shrink(void)
+{
+	size_t i, before;
+	sheaf_t stack;
+	int ret;
+
+	if (sheaf_init(&stack, 2, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	before = pages_used();
+
+	for (i = 0; i < SPIKE; ++i) {
+		if (sheaf_push(&stack, i, 0))
+			errx(EXIT_FAILURE, "sheaf_push");
+	}
+	if (sheaf_pop_all(&stack, NULL, NULL, 0))
+		errx(EXIT_FAILURE, "sheaf_pop_all");
+
+	/* Keep a couple of pages' worth of nodes around */
+	ret = sheaf_shrink(&stack, 0, NODES_PER_PAGE * 2);
+	if (ret < 60) {
+		warnx("sheaf_shrink(keep=%lu): returned %d, expected at least 60",
+			  NODES_PER_PAGE * 2, ret);
+		return 1;
+	}
+
+	/* Nothing left to give back */
+	ret = sheaf_shrink(&stack, 0, NODES_PER_PAGE * 2);
+	if (ret) {
+		warnx("sheaf_shrink(keep=%lu): returned %d, expected 0",
+			  NODES_PER_PAGE * 2, ret);
+		return 1;
+	}
+
+	/* Give back everything, including the pre-allocated page */
+	sheaf_shrink(&stack, 0, 0);
+	if (pages_used() != before - 1) {
+		warnx("sheaf_shrink(keep=0): %lu pages in use, expected %lu",
+			  pages_used(), before - 1);
+		return 1;
+	}
+
+	/* The stack must still work */
+	if (sheaf_push(&stack, 1, 0) || sheaf_pop(&stack, NULL, 0))
+		errx(EXIT_FAILURE, "sheaf_push/sheaf_pop after shrink");
+
+	sheaf_release(&stack);
+
+	if (pages_used()) {
+		warnx("sheaf_release(): leaked %lu pages", pages_used());
+		return 1;
+	}
+
+	return 0;
+}
+
+static size_t _Atomic counters[NTHREADS] = { 0 };
+
+struct args {
+	sheaf_t *stack;
+	size_t count;
+	uintptr_t val;
+	size_t id;
+	pthread_barrier_t *barrier;
+	int num_cores;
+};
+
+/* Push and pop in bursts, giving back memory between bursts */
+static void *worker(void *ctx)
+{
+	struct args *args = ctx;
+	sheaf_t *stack = args->stack;
+	size_t i, j;
+	uintptr_t val;
+	int ret;
+
+	pin_to_core(args->id, args->num_cores);
+	barrier_wait(args->barrier);
+
+	for (i = 0; i < args->count; i += NODES_PER_PAGE) {
+		for (j = 0; j < NODES_PER_PAGE; ++j) {
+			ret = sheaf_push(stack, args->val, args->id);
+			if (ret)
+				errx(EXIT_FAILURE, "sheaf_push: %s", strerror(-ret));
+		}
+
+		for (j = 0; j < NODES_PER_PAGE; ++j) {
+			do {
+				ret = sheaf_pop(stack, &val, args->id);
+			} while (ret == -SHEAF_EAGAIN);
+
+			if (ret)
+				errx(EXIT_FAILURE, "sheaf_pop: %s", strerror(-ret));
+			atomic_fetch_add_explicit(&counters[val], 1,
+									  memory_order_relaxed);
+		}
+
+		ret = sheaf_shrink(stack, args->id, 0);
+		if (ret < 0)
+			errx(EXIT_FAILURE, "sheaf_shrink: %s", strerror(-ret));
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	sheaf_t stack;
+	size_t i, total = 0;
+	pthread_t thrds[NTHREADS];
+	struct args args[NTHREADS], *arg;
+	pthread_barrier_t barrier;
+	int ret;
+	int num_cores;
+
+	(void)argc;
+	(void)argv;
+
+	if (check_shrink())
+		return EXIT_FAILURE;
+
+	num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores <= 0)
+		err(EXIT_FAILURE, "sysconf(_SC_NPROCESSORS_ONLN)");
+
+	if (pthread_barrier_init(&barrier, NULL, NTHREADS))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	ret = sheaf_init(&stack, NTHREADS, &count_pa);
+	if (ret)
+		errx(EXIT_FAILURE, "sheaf_init: %s", strerror(-ret));
+
+	for (i = 0; i < NTHREADS; ++i) {
+		arg = &args[i];
+		arg->stack = &stack;
+		arg->count = NELEMS;
+		arg->val = i;
+		arg->id = i;
+		arg->barrier = &barrier;
+		arg->num_cores = num_cores;
+		if (pthread_create(&thrds[i], NULL, worker, arg))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	for (i = 0; i < NTHREADS; ++i) {
+		if (pthread_join(thrds[i], NULL))
+			warn("pthread_join");
+	}
+
+	sheaf_release(&stack);
+	pthread_barrier_destroy(&barrier);
+
+	/* Each thread pops as many values as it pushes, but not
+	 * necessarily its own */
+	for (i = 0; i < NTHREADS; ++i)
+		total += counters[i];
+	assert(total == NTHREADS * ((NELEMS + NODES_PER_PAGE - 1) /
+								NODES_PER_PAGE * NODES_PER_PAGE));
+	assert(!pages_used());
+
+	return EXIT_SUCCESS;
+}
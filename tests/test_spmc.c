@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "libtest.h"
+#include "spmc.h"
+
+#define PRODUCER 0UL
+#define NCONSUMERS 4UL
+#define NELEMS 200000UL
+
+static sheaf_spmc_t stack;
+static pthread_barrier_t barrier;
+static _Atomic unsigned char seen[NELEMS];
+static _Atomic size_t consumed = 0;
+
+static void *producer(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+	barrier_wait(&barrier);
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_spmc_push(&stack, i, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_spmc_push");
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	size_t ncpu = PRODUCER + 1 + (size_t)arg;
+	uintptr_t val;
+
+	barrier_wait(&barrier);
+
+	while (atomic_load(&consumed) < NELEMS) {
+		if (sheaf_spmc_pop(&stack, &val, ncpu))
+			continue;
+		if (val >= NELEMS || atomic_fetch_add(&seen[val], 1))
+			errx(EXIT_FAILURE, "value %lu popped twice",
+				 (unsigned long)val);
+		atomic_fetch_add(&consumed, 1);
+	}
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t threads[NCONSUMERS + 1];
+	uintptr_t val;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_spmc_init(NULL, 1, &count_pa) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_spmc_init(NULL)");
+	if (sheaf_spmc_init(&stack, NCONSUMERS + 1, &count_pa))
+		errx(EXIT_FAILURE, "sheaf_spmc_init");
+	if (sheaf_spmc_pop(&stack, &val, 1) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "pop from empty stack");
+	if (sheaf_spmc_pop(&stack, &val, NCONSUMERS + 1) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_spmc_pop(bad ncpu)");
+
+	if (pthread_barrier_init(&barrier, NULL, NCONSUMERS + 1))
+		err(EXIT_FAILURE, "pthread_barrier_init");
+
+	if (pthread_create(&threads[0], NULL, producer, NULL))
+		err(EXIT_FAILURE, "pthread_create");
+	for (i = 0; i < NCONSUMERS; ++i) {
+		if (pthread_create(&threads[i + 1], NULL, consumer, (void *)i))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < NCONSUMERS + 1; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (sheaf_spmc_pop(&stack, &val, 1) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "stack not empty");
+
+	/* Leave a few values behind for release to give back */
+	for (i = 0; i < 10; ++i) {
+		if (sheaf_spmc_push(&stack, i, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_spmc_push");
+	}
+
+	pthread_barrier_destroy(&barrier);
+	sheaf_spmc_release(&stack);
+
+	if (pages_used())
+		errx(EXIT_FAILURE, "%zu pages leaked", pages_used());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtest.h"
+#include "sheaf.h"
+
+/* Exactly fills the pre-allocated page of a CPU and two more */
+#define NELEMS (NODES_PER_PAGE * 3)
+
+#define PRODUCER 0UL
+#define CONSUMER 1UL
+
+#define CHECK(cond)                                                         \
+	do {                                                                    \
+		if (!(cond)) {                                                      \
+			warnx("%s:%d: %s", __FILE__, __LINE__, #cond);                  \
+			return EXIT_FAILURE;                                            \
+		}                                                                   \
+	} while (0)
+
+int main(int argc, const char *argv[])
+{
+	struct sheaf_stats st;
+	uintptr_t vals[8];
+	sheaf_t stack;
+	size_t i;
+
+	(void)argc;
+	(void)argv;
+
+	if (sheaf_init(&stack, 2, &pa))
+		errx(EXIT_FAILURE, "sheaf_init");
+
+	for (i = 0; i < NELEMS; ++i) {
+		if (sheaf_push(&stack, i, PRODUCER))
+			errx(EXIT_FAILURE, "sheaf_push");
+	}
+
+	/* Every node the producer pushed goes back to it from the consumer */
+	for (i = 0; i < NELEMS - 8; ++i) {
+		if (sheaf_pop(&stack, NULL, CONSUMER))
+			errx(EXIT_FAILURE, "sheaf_pop");
+	}
+	if (sheaf_pop_bulk(&stack, vals, 8, CONSUMER) != 8)
+		errx(EXIT_FAILURE, "sheaf_pop_bulk");
+	if (sheaf_pop(&stack, NULL, CONSUMER) != -SHEAF_EAGAIN)
+		errx(EXIT_FAILURE, "sheaf_pop on empty stack");
+	sheaf_pop_all(&stack, NULL, NULL, CONSUMER);
+
+	/* The producer takes some of them back from its ring */
+	if (sheaf_push(&stack, 0, PRODUCER))
+		errx(EXIT_FAILURE, "sheaf_push");
+
+	if (sheaf_stats_read(&stack, NULL) != -SHEAF_EINVAL)
+		errx(EXIT_FAILURE, "sheaf_stats_read(NULL)");
+	if (sheaf_stats_read(&stack, &st))
+		errx(EXIT_FAILURE, "sheaf_stats_read");
+
+#ifdef SHEAF_STATS
+	CHECK(st.push == NELEMS + 1);
+	CHECK(st.pop == NELEMS);
+	CHECK(st.pop_empty == 2);
+	CHECK(!st.push_retry && !st.pop_retry);
+	CHECK(st.remote_free == NELEMS);
+	CHECK(st.deferred > 0 && st.deferred <= NELEMS);
+	CHECK(!st.ring_full);
+	CHECK(st.page_alloc == 4);
+#else
+	/* Counters are compiled out */
+	for (i = 0; i < sizeof(st) / sizeof(uint64_t); ++i)
+		CHECK(!((uint64_t *)&st)[i]);
+#endif
+
+	sheaf_release(&stack);
+
+	return EXIT_SUCCESS;
+}